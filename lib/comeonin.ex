@@ -12,6 +12,12 @@ defmodule Comeonin do
   """
   @callback add_hash(password, opts) :: map
 
+  @doc """
+  Hashes a stream of passwords, or of records with a password, concurrently,
+  and returns a stream of the password hashes in maps, in the same order.
+  """
+  @callback add_hash_stream(Enumerable.t(), opts) :: Enumerable.t()
+
   @doc """
   Checks the password by comparing its hash with the password hash found
   in a user struct, or map.
@@ -19,7 +25,14 @@ defmodule Comeonin do
   The first argument to `check_pass/3` should be a user struct, a regular
   map, or nil.
   """
-  @callback check_pass(user_struct, password, opts) :: {:ok, map} | {:error, String.t()}
+  @callback check_pass(user_struct, password, opts) ::
+              {:ok, map} | {:ok, map, binary} | {:error, String.t()}
+
+  @doc """
+  Checks a step-up ticket returned by `check_pass/3` with the `ticket: true`
+  option.
+  """
+  @callback verify_ticket(map, binary | nil, opts) :: {:ok, map} | {:error, String.t()}
 
   @doc """
   Runs the password hash function, but always returns false.
@@ -30,10 +43,13 @@ defmodule Comeonin do
   """
   @callback no_user_verify(opts) :: false
 
+  @optional_callbacks add_hash_stream: 2, verify_ticket: 3
+
   defmacro __using__(_) do
     quote do
       @behaviour Comeonin
       @behaviour Comeonin.PasswordHash
+      @before_compile Comeonin
 
       @doc """
       Hashes a password, using `hash_pwd_salt/2`, and returns the password hash in a map.
@@ -51,6 +67,9 @@ defmodule Comeonin do
 
         * `:hash_key` - the password hash identifier
           * the default is `:password_hash`
+        * `:priority` - the priority in the hashing pool, if it is running
+          * `:high`, `:normal` or `:low` - the default is `:normal`
+          * see `Comeonin.Pool`
 
       ## Example with Ecto
 
@@ -70,7 +89,95 @@ defmodule Comeonin do
       @impl Comeonin
       def add_hash(password, opts \\ []) do
         hash_key = opts[:hash_key] || :password_hash
-        %{hash_key => hash_pwd_salt(password, opts)}
+
+        instrument(:add_hash, opts, fn ->
+          case pooled(opts, fn -> hash_pwd_salt(password, opts) end) do
+            {:error, :overloaded} -> raise "the hashing pool is overloaded"
+            hash -> {%{hash_key => hash}, :ok, hash}
+          end
+        end)
+      end
+
+      @doc """
+      Hashes an enumerable of passwords, or of records, using `add_hash/2`, and
+      returns a stream of the results, in the same order.
+
+      This is meant for bulk imports. The hashes are run concurrently, but no
+      more than `:max_concurrency` at a time - the next password is only read
+      when a hash finishes, so the input can be a lazy stream of any size.
+
+      Each element can be a password, which is replaced by the map returned by
+      `add_hash/2`, or a map with a password, which has the password removed
+      and the password hash added. Any other element raises an `ArgumentError`
+      when it is read, before it is hashed.
+
+      ## Options
+
+      In addition to the options below, this function takes the options of
+      `add_hash/2`.
+
+        * `:password_key` - the key of the password in the records
+          * the default is `:password`
+        * `:max_concurrency` - the number of hashes run at the same time
+          * the default is derived from the CPU quota and memory limit of the
+            container (see `Comeonin.Limits.derive/2`)
+        * `:per_hash_memory` - the memory, in bytes, that one hash uses, which
+          caps the default `:max_concurrency`
+        * `:chunk_size` - return lists of this many results, instead of single
+          results
+
+      ## Example with Ecto
+
+          File.stream!("users.csv")
+          |> Stream.map(&parse_user/1)
+          |> add_hash_stream(chunk_size: 1000)
+          |> Enum.each(&Repo.insert_all(User, &1))
+
+      """
+      @impl Comeonin
+      def add_hash_stream(enumerable, opts \\ []) do
+        stream_keys = [:password_key, :max_concurrency, :per_hash_memory, :chunk_size]
+        {stream_opts, opts} = Keyword.split(opts, stream_keys)
+        password_key = Keyword.get(stream_opts, :password_key, :password)
+
+        limits_opts = [
+          size: stream_opts[:max_concurrency],
+          per_hash_memory: stream_opts[:per_hash_memory]
+        ]
+
+        limits = Comeonin.Limits.derive(Comeonin.Limits.read(), limits_opts)
+
+        stream =
+          enumerable
+          |> Stream.each(fn
+            password when is_binary(password) ->
+              :ok
+
+            %{^password_key => password} when is_binary(password) ->
+              :ok
+
+            _ ->
+              raise ArgumentError,
+                    "add_hash_stream expects passwords, or maps with a password " <>
+                      "in the #{inspect(password_key)} key"
+          end)
+          |> Task.async_stream(
+            fn
+              password when is_binary(password) ->
+                add_hash(password, opts)
+
+              %{^password_key => password} = record ->
+                record |> Map.delete(password_key) |> Map.merge(add_hash(password, opts))
+            end,
+            max_concurrency: limits.concurrency,
+            timeout: :infinity
+          )
+          |> Stream.map(fn {:ok, result} -> result end)
+
+        case stream_opts[:chunk_size] do
+          nil -> stream
+          size -> Stream.chunk_every(stream, size)
+        end
       end
 
       @doc """
@@ -80,12 +187,32 @@ defmodule Comeonin do
       This is a convenience function that takes a user struct, or map, as input
       and seamlessly handles the cases where no user is found.
 
+      The user can also be a map with string keys, a keyword list, or a raw
+      database row (a list or tuple, such as a `Postgrex` result row), so that
+      the login path does not need to load a schema.
+
       ## Options
 
         * `:hash_key` - the password hash identifier
-          * this does not need to be set if the key is `:password_hash` or `:encrypted_password`
+          * this does not need to be set if the key is `:password_hash` or
+            `:encrypted_password`, as an atom or a string
+          * for list and tuple rows, this can be the 0-based position of the hash
+          * this can also be a function that takes the user and returns the
+            hash, or nil - if it returns part of a larger binary, such as a
+            field of a raw row, the hash is not copied
         * `:hide_user` - run the `no_user_verify/1` function if no user is found
           * the default is true
+        * `:priority` - the priority in the hashing pool, if it is running
+          * see `Comeonin.Pool`
+        * `:timeout` - the time, in milliseconds, that the hash can wait in the
+          hashing pool queue before `{:error, "hashing is overloaded"}` is
+          returned
+          * the default is `:infinity`
+        * `:ticket` - return `{:ok, user, ticket}`, where the ticket can be checked
+          with `verify_ticket/3` instead of the password, until it expires
+          * the default is false
+          * an error is returned if the user has no id
+          * see `Comeonin.Ticket` for the other ticket options
 
       ## Example
 
@@ -105,30 +232,145 @@ defmodule Comeonin do
       def check_pass(user, password, opts \\ [])
 
       def check_pass(nil, _password, opts) do
-        unless opts[:hide_user] == false, do: no_user_verify(opts)
-        {:error, "invalid user-identifier"}
+        instrument(:check_pass, opts, fn ->
+          unless opts[:hide_user] == false, do: pooled(opts, fn -> no_user_verify(opts) end)
+          {{:error, "invalid user-identifier"}, :no_user, nil}
+        end)
       end
 
       def check_pass(user, password, opts) when is_binary(password) do
-        case get_hash(user, opts[:hash_key]) do
-          {:ok, hash} ->
-            if verify_pass(password, hash), do: {:ok, user}, else: {:error, "invalid password"}
+        instrument(:check_pass, opts, fn ->
+          case get_hash(user, opts[:hash_key]) do
+            {:ok, hash} ->
+              case pooled(opts, fn -> verify_pass(password, hash) end) do
+                {:error, :overloaded} ->
+                  {{:error, "hashing is overloaded"}, :overloaded, hash}
+
+                false ->
+                  {{:error, "invalid password"}, :invalid_password, hash}
+
+                true ->
+                  if opts[:ticket] do
+                    with_ticket(user, hash, opts)
+                  else
+                    {{:ok, user}, :ok, hash}
+                  end
+              end
+
+            _ ->
+              {{:error, "no password hash found in the user struct"}, :no_hash, nil}
+          end
+        end)
+      end
+
+      def check_pass(_, _, opts) do
+        instrument(:check_pass, opts, fn ->
+          {{:error, "password is not a string"}, :invalid_input, nil}
+        end)
+      end
+
+      @doc """
+      Checks a ticket returned by `check_pass/3` with the `ticket: true` option.
 
-          _ ->
-            {:error, "no password hash found in the user struct"}
+      This takes microseconds, instead of a full password verification. The
+      ticket is rejected if it has expired, if it was issued for another user,
+      or if the user's password hash has changed since it was issued.
+
+      ## Options
+
+      The options are the same as those given to `check_pass/3` when the ticket
+      was issued - see `Comeonin.Ticket`.
+      """
+      @impl Comeonin
+      def verify_ticket(user, ticket, opts \\ [])
+
+      def verify_ticket(nil, _ticket, _opts), do: {:error, "invalid user-identifier"}
+
+      def verify_ticket(user, ticket, opts) do
+        user_id = Comeonin.Ticket.user_id(user, opts)
+
+        with {:ok, hash} <- get_hash(user, opts[:hash_key]),
+             :ok <- Comeonin.Ticket.verify(user_id, hash, ticket, opts) do
+          {:ok, user}
+        else
+          {:error, :expired} -> {:error, "ticket has expired"}
+          _ -> {:error, "invalid ticket"}
         end
       end
 
-      def check_pass(_, _, _) do
-        {:error, "password is not a string"}
+      defp with_ticket(user, hash, opts) do
+        case Comeonin.Ticket.user_id(user, opts) do
+          nil ->
+            {{:error, "no user id found in the user struct"}, :invalid_input, hash}
+
+          user_id ->
+            {{:ok, user, Comeonin.Ticket.issue(user_id, hash, opts)}, :ok, hash}
+        end
       end
 
+      defp get_hash(user, extract) when is_function(extract, 1), do: found_hash(extract.(user))
       defp get_hash(%{password_hash: hash}, nil), do: {:ok, hash}
       defp get_hash(%{encrypted_password: hash}, nil), do: {:ok, hash}
+      defp get_hash(%{"password_hash" => hash}, nil), do: {:ok, hash}
+      defp get_hash(%{"encrypted_password" => hash}, nil), do: {:ok, hash}
+
+      defp get_hash([{_, _} | _] = row, nil) do
+        keys = [:password_hash, :encrypted_password, "password_hash", "encrypted_password"]
+        Enum.find_value(keys, &get_hash(row, &1))
+      end
+
       defp get_hash(_, nil), do: nil
 
-      defp get_hash(user, hash_key) do
-        if hash = Map.get(user, hash_key), do: {:ok, hash}
+      defp get_hash(row, index) when is_tuple(row) and is_integer(index) do
+        if index >= 0 and index < tuple_size(row), do: found_hash(elem(row, index))
+      end
+
+      defp get_hash(row, index) when is_list(row) and is_integer(index) do
+        found_hash(Enum.at(row, index))
+      end
+
+      defp get_hash(row, hash_key) when is_list(row) do
+        case List.keyfind(row, hash_key, 0) do
+          {_, hash} -> found_hash(hash)
+          nil -> nil
+        end
+      end
+
+      defp get_hash(user, hash_key) when is_map(user) do
+        found_hash(Map.get(user, hash_key))
+      end
+
+      defp get_hash(_, _), do: nil
+
+      defp found_hash(nil), do: nil
+      defp found_hash(false), do: nil
+      defp found_hash(hash), do: {:ok, hash}
+
+      # Runs the function and updates the stats and the recorder. The function
+      # returns the result, the outcome and the hash that was used, if any.
+      defp instrument(operation, opts, fun) do
+        stats = Comeonin.Stats.start(__MODULE__, operation)
+        started = Comeonin.Recorder.start_time()
+
+        {result, outcome, hash} =
+          try do
+            fun.()
+          catch
+            kind, reason ->
+              Comeonin.Stats.stop(stats, :exception)
+              :erlang.raise(kind, reason, __STACKTRACE__)
+          end
+
+        Comeonin.Recorder.record(operation, outcome, hash, started)
+        Comeonin.Stats.stop(stats, outcome)
+        result
+      end
+
+      # Runs a hash in the hashing pool, if it is running, with the :priority
+      # and :timeout options. Only the hash is sent to the pool worker, not the
+      # user or the rest of the request.
+      defp pooled(opts, fun) do
+        Comeonin.Pool.run(fun, [module: __MODULE__] ++ Keyword.take(opts, [:priority, :timeout]))
       end
 
       @doc """
@@ -167,4 +409,19 @@ defmodule Comeonin do
       defoverridable Comeonin
     end
   end
+
+  @doc false
+  defmacro __before_compile__(env) do
+    if Module.defines?(env.module, {:hash_pwd_salt, 2}) do
+      quote do
+        defoverridable hash_pwd_salt: 2
+
+        @impl Comeonin.PasswordHash
+        def hash_pwd_salt(password, opts) do
+          opts = Keyword.merge(Comeonin.AutoTuner.opts(__MODULE__), opts)
+          super(password, Comeonin.CostProfile.opts(__MODULE__, opts))
+        end
+      end
+    end
+  end
 end
@@ -0,0 +1,48 @@
+defmodule Comeonin.Application do
+  @moduledoc false
+
+  use Application
+
+  def start(_type, _args) do
+    Comeonin.CostProfile.load()
+
+    children =
+      stats_children() ++
+        pool_children() ++ autotune_children() ++ server_children() ++ monitor_children()
+
+    Supervisor.start_link(children, strategy: :one_for_one, name: Comeonin.Supervisor)
+  end
+
+  defp stats_children do
+    if Application.get_env(:comeonin, :stats, true), do: [Comeonin.Stats], else: []
+  end
+
+  defp pool_children do
+    case Application.get_env(:comeonin, :pool) do
+      nil -> []
+      false -> []
+      true -> [{Comeonin.Pool, []}]
+      opts -> [{Comeonin.Pool, opts}]
+    end
+  end
+
+  defp server_children do
+    case Application.get_env(:comeonin, :server) do
+      nil -> []
+      opts -> [{Comeonin.Server, opts}]
+    end
+  end
+
+  defp monitor_children do
+    case Application.get_env(:comeonin, :monitor) do
+      nil -> []
+      false -> []
+      true -> [{Comeonin.Monitor, []}]
+      opts -> [{Comeonin.Monitor, opts}]
+    end
+  end
+
+  defp autotune_children do
+    for opts <- Application.get_env(:comeonin, :autotune, []), do: {Comeonin.AutoTuner, opts}
+  end
+end
@@ -0,0 +1,235 @@
+defmodule Comeonin.AutoTuner do
+  @moduledoc """
+  Adjusts the cost of new hashes at runtime, to hold a latency target.
+
+  Offline calibration goes out of date as the hardware, the other
+  services on the host and the traffic change. The auto-tuner watches
+  the latency of `add_hash/2` (using `Comeonin.Stats`) and the busy time
+  of the dirty CPU schedulers, and raises or lowers one cost option, one
+  step at a time, between a floor and a ceiling. It turns on
+  `:scheduler_wall_time` while it runs, and restores the previous setting
+  when it stops.
+
+  The current options are published with `:persistent_term`, so reading
+  them in `hash_pwd_salt/2` costs almost nothing. They are used as
+  defaults - options passed to `hash_pwd_salt/2` override them. Every
+  change is logged.
+
+  Start an auto-tuner for each implementation in your supervision tree,
+  or list them in the `:autotune` config of the `:comeonin` application:
+
+      children = [
+        {Comeonin.AutoTuner,
+         module: Argon2, param: :t_cost, floor: 3, ceiling: 8, target_ms: 300}
+      ]
+
+  Existing hashes keep their cost. To upgrade them as users log in, check
+  `needs_rehash?/2` after a successful `check_pass/3`, and store a new
+  hash if it returns true.
+
+  ## Options
+
+    * `:module` - the implementation (required)
+    * `:param` - the cost option to adjust (required)
+    * `:floor` - the lowest value, which is the security floor (required)
+    * `:ceiling` - the highest value (required)
+    * `:initial` - the starting value
+      * the default is the floor
+    * `:step` - the amount the value changes by
+      * the default is 1
+    * `:scale` - `:linear` if the cost is proportional to the value (for
+      example, `t_cost`), or `:exponential` if each step doubles the cost
+      (for example, `log_rounds` or `m_cost`)
+      * the default is `:linear`
+    * `:target_ms` - the p99 latency target for `add_hash/2`
+      * the default is 250
+    * `:headroom` - the fraction of dirty CPU time that must stay free
+      * the default is 0.2
+    * `:interval` - the time, in milliseconds, between adjustments
+      * the default is 30_000
+    * `:min_samples` - below this number of `add_hash/2` calls in an
+      interval, the latency is measured by hashing a probe password
+      * the default is 20
+  """
+
+  use GenServer
+
+  require Logger
+
+  @probe "comeonin auto-tuner probe"
+
+  @doc false
+  def child_spec(opts) do
+    %{id: {__MODULE__, Keyword.fetch!(opts, :module)}, start: {__MODULE__, :start_link, [opts]}}
+  end
+
+  @doc false
+  def start_link(opts) do
+    GenServer.start_link(__MODULE__, opts)
+  end
+
+  @doc """
+  Returns the tuned options for `module`, or an empty list if it is not
+  being tuned.
+  """
+  @spec opts(module) :: keyword
+  def opts(module) do
+    case :persistent_term.get({__MODULE__, module}, nil) do
+      %{opts: opts} -> opts
+      nil -> []
+    end
+  end
+
+  @doc """
+  Checks if a hash was created with different parameters from the ones
+  that are currently tuned.
+
+  Returns false if `module` is not being tuned.
+  """
+  @spec needs_rehash?(module, binary) :: boolean
+  def needs_rehash?(module, hash) do
+    case :persistent_term.get({__MODULE__, module}, nil) do
+      %{prefix: prefix} -> Comeonin.HashInfo.prefix(hash) != prefix
+      nil -> false
+    end
+  end
+
+  @doc """
+  Decides the next value of the cost option.
+
+  `latency_us` is the observed p99 latency and `utilization` the busy
+  fraction of the dirty CPU schedulers, or nil if it is not known.
+  Returns `{value, reason}`.
+  """
+  @spec decide(integer, non_neg_integer, float | nil, map) :: {integer, String.t()}
+  def decide(value, latency_us, utilization, config) do
+    target_us = config.target_ms * 1000
+    p99 = "p99 #{div(latency_us, 1000)} ms"
+    busy_limit = 1 - config.headroom
+    utilization = utilization || 0.0
+    up = min(value + config.step, config.ceiling)
+    down = max(value - config.step, config.floor)
+
+    cond do
+      latency_us > target_us and value > config.floor ->
+        {down, "#{p99} is above the #{config.target_ms} ms target"}
+
+      utilization > busy_limit and value > config.floor ->
+        {down, "dirty CPU utilization #{percent(utilization)} leaves less than the headroom"}
+
+      up > value and predict(latency_us, value, up, config.scale) < 0.8 * target_us and
+          utilization < 1 - 2 * config.headroom ->
+        {up, "#{p99} leaves room under the #{config.target_ms} ms target"}
+
+      true ->
+        {value, "unchanged"}
+    end
+  end
+
+  defp predict(latency_us, value, next, :linear), do: latency_us * next / max(value, 1)
+
+  defp predict(latency_us, value, next, :exponential) do
+    latency_us * :math.pow(2, next - value)
+  end
+
+  defp percent(fraction), do: "#{Float.round(fraction * 100, 1)}%"
+
+  @impl true
+  def init(opts) do
+    config = %{
+      module: Keyword.fetch!(opts, :module),
+      param: Keyword.fetch!(opts, :param),
+      floor: Keyword.fetch!(opts, :floor),
+      ceiling: Keyword.fetch!(opts, :ceiling),
+      step: Keyword.get(opts, :step, 1),
+      scale: Keyword.get(opts, :scale, :linear),
+      target_ms: Keyword.get(opts, :target_ms, 250),
+      headroom: Keyword.get(opts, :headroom, 0.2),
+      interval: Keyword.get(opts, :interval, 30_000),
+      min_samples: Keyword.get(opts, :min_samples, 20)
+    }
+
+    Process.flag(:trap_exit, true)
+    wall_time = :erlang.system_flag(:scheduler_wall_time, true)
+    value = Keyword.get(opts, :initial, config.floor)
+    publish(config, value)
+    schedule(config)
+
+    {:ok,
+     %{
+       config: config,
+       value: value,
+       histogram: histogram(config),
+       cpu: dirty_cpu_time(),
+       wall_time: wall_time
+     }}
+  end
+
+  @impl true
+  def handle_info(:tune, %{config: config} = state) do
+    histogram = histogram(config)
+    cpu = dirty_cpu_time()
+    delta = diff(histogram, state.histogram)
+
+    latency_us =
+      if Enum.sum(delta) >= config.min_samples do
+        Comeonin.Stats.percentile(delta, 99)
+      else
+        probe(config, state.value)
+      end
+
+    {value, reason} = decide(state.value, latency_us, utilization(state.cpu, cpu), config)
+
+    if value != state.value do
+      Logger.info(
+        "Comeonin.AutoTuner changed #{inspect(config.module)} #{config.param} " <>
+          "from #{state.value} to #{value}: #{reason}"
+      )
+
+      publish(config, value)
+    end
+
+    schedule(config)
+    {:noreply, %{state | value: value, histogram: histogram, cpu: cpu}}
+  end
+
+  def handle_info(_message, state), do: {:noreply, state}
+
+  @impl true
+  def terminate(_reason, %{config: config, wall_time: wall_time}) do
+    :erlang.system_flag(:scheduler_wall_time, wall_time)
+    :persistent_term.erase({__MODULE__, config.module})
+  end
+
+  defp publish(config, value) do
+    opts = [{config.param, value}]
+    prefix = Comeonin.HashInfo.prefix(config.module.hash_pwd_salt(@probe, opts))
+    :persistent_term.put({__MODULE__, config.module}, %{opts: opts, prefix: prefix})
+  end
+
+  defp probe(config, value) do
+    times =
+      for _ <- 1..3 do
+        {time, _} = :timer.tc(config.module, :hash_pwd_salt, [@probe, [{config.param, value}]])
+        time
+      end
+
+    times |> Enum.sort() |> Enum.at(1)
+  end
+
+  defp histogram(config), do: Comeonin.Stats.histogram(config.module, :add_hash)
+
+  defp diff([], _), do: []
+  defp diff(new, []), do: new
+  defp diff(new, old), do: new |> Enum.zip(old) |> Enum.map(fn {x, y} -> x - y end)
+
+  defp dirty_cpu_time, do: Comeonin.Stats.dirty_cpu_time()
+
+  defp utilization({active0, total0}, {active1, total1}) when total1 > total0 do
+    (active1 - active0) / (total1 - total0)
+  end
+
+  defp utilization(_, _), do: nil
+
+  defp schedule(config), do: Process.send_after(self(), :tune, config.interval)
+end
@@ -1,8 +1,53 @@
 defmodule Comeonin.BehaviourTestHelper do
   @moduledoc """
   Test helper functions for Comeonin behaviours.
+
+  The checks that take an `opts` argument pass it on to `hash_pwd_salt/2`
+  (and `check_pass/3`), so that they can be run with low-cost options,
+  for example, `t_cost: 1, m_cost: 8` for Argon2 or `log_rounds: 4` for
+  Bcrypt.
+
+  The checks that verify several wrong passwords run the verifications
+  concurrently.
+
+  The checks call the helper functions of the implementation, so they go
+  through the same global state as those functions: the calls are
+  counted in `Comeonin.Stats`, they run in `Comeonin.Pool` if it is
+  running, and the options of the `Comeonin.CostProfile` and of a
+  `Comeonin.AutoTuner` for the module are merged into `opts` (the cost
+  profile overrides them). The checks only read this state, so they can
+  be run in `async: true` test cases, as long as no other test changes
+  the cost profile or tunes the same module at the same time.
+
+  ## Large inputs
+
+  `long_passwords/0`, `unicode_heavy_passwords/0`, `binary_edge_passwords/0`,
+  `password_stream/2` and `password_corpus/1` generate inputs beyond the
+  short lists above. `hash_time_bounded/3` and `multibyte_time_stable/3`
+  check that the time taken does not grow with the size of the password,
+  or with the number of bytes per character, which catches algorithms
+  that do work per byte of the password on every iteration.
   """
 
+  # The combining marks (0x483..0x489, 0x3099..0x309A) and the emoji
+  # modifiers (0x1F3FB..0x1F3FF) are left out of these ranges, so that
+  # every codepoint is a grapheme of its own.
+  @unicode_ranges [
+    0xA1..0xFF,
+    0x400..0x482,
+    0x48A..0x4FF,
+    0x5D0..0x5EA,
+    0x3041..0x3096,
+    0x309B..0x30FF,
+    0x4E00..0x9FFF,
+    0x1F300..0x1F3FA,
+    0x1F400..0x1F5FF
+  ]
+  @corpus_lengths [1, 8, 64, 256, 1024]
+  @time_sizes [8, 64, 1024, 4096]
+  @min_time_us 10_000
+  @max_iterations 100_000
+
   @doc """
   List of passwords that just contain basic ascii characters.
   """
@@ -17,64 +62,236 @@ defmodule Comeonin.BehaviourTestHelper do
     ["påsswörd", "aáåä eéê ëoôö", "мадам, я доктор, вот банан", "Я❤três☕ où☔"]
   end
 
+  @doc """
+  List of long passwords, up to 64 KiB, with ascii and non-ascii characters.
+  """
+  def long_passwords do
+    for size <- [256, 4096, 65_536], char <- ["a", "ж", "☕"] do
+      String.duplicate(char, div(size, byte_size(char)))
+    end
+  end
+
+  @doc """
+  List of passwords with combining characters, joined emoji sequences,
+  right-to-left text and characters outside the Basic Multilingual Plane.
+  """
+  def unicode_heavy_passwords do
+    [
+      "e\u0301\u0302\u0303\u0304 a\u0308\u0323",
+      "\u{1F469}\u200D\u{1F469}\u200D\u{1F467}\u200D\u{1F466}\u{1F3F3}\uFE0F\u200D\u{1F308}",
+      "\u05E9\u05DC\u05D5\u05DD \u05E2\u05D5\u05DC\u05DD 123",
+      "\u65E5\u672C\u8A9E\u306E\u30D1\u30B9\u30EF\u30FC\u30C9",
+      "\u{1D518}\u{1D52B}\u{1D526}\u{1D520}\u{1D52C}\u{1D521}\u{1D522}"
+    ]
+  end
+
+  @doc """
+  List of passwords at the edges of what a binary can hold - empty
+  passwords, null bytes, invalid UTF-8 and passwords either side of
+  the 72-byte limit of bcrypt.
+
+  These are not valid input to `wrong_password_false/3`, as slicing
+  them is not meaningful, but every implementation should hash and
+  verify them.
+  """
+  def binary_edge_passwords do
+    [
+      "",
+      <<0>>,
+      "pass\0word",
+      <<255, 254, 253>>,
+      <<0xC3>>,
+      <<0xED, 0xA0, 0x80>>,
+      String.duplicate("a", 72),
+      String.duplicate("a", 73)
+    ]
+  end
+
+  @doc """
+  Returns a stream of random passwords of one kind.
+
+  `kind` can be `:ascii`, `:unicode` or `:binary`.
+
+  ## Options
+
+    * `:length` - the number of codepoints, or bytes for `:binary`
+      * the default is 16
+  """
+  def password_stream(kind, opts \\ []) when kind in [:ascii, :unicode, :binary] do
+    length = Keyword.get(opts, :length, 16)
+    Stream.repeatedly(fn -> random_password(kind, length) end)
+  end
+
+  @doc """
+  Returns a stream of random passwords of mixed kinds and lengths.
+
+  The stream is lazy, so large corpora can be generated without holding
+  them in memory.
+
+  ## Options
+
+    * `:kinds` - the kinds of password (see `password_stream/2`)
+      * the default is `[:ascii, :unicode, :binary]`
+    * `:lengths` - the lengths to choose from
+      * the default is `#{inspect(@corpus_lengths)}`
+  """
+  def password_corpus(opts \\ []) do
+    kinds = Keyword.get(opts, :kinds, [:ascii, :unicode, :binary])
+    lengths = Keyword.get(opts, :lengths, @corpus_lengths)
+    Stream.repeatedly(fn -> random_password(Enum.random(kinds), Enum.random(lengths)) end)
+  end
+
+  @doc """
+  Checks that `correct_password_true/3` holds for every password in an
+  enumerable, such as a slice of `password_corpus/1`.
+
+  The passwords are checked concurrently.
+  """
+  def corpus_verifies(module, passwords, opts \\ []) do
+    all_concurrently?(passwords, &correct_password_true(module, &1, opts))
+  end
+
+  @doc """
+  Checks that the time taken by `hash_pwd_salt/2` and `verify_pass/2` does
+  not grow with the length of the password.
+
+  Passwords of #{Enum.join(@time_sizes, ", ")} bytes are hashed and
+  verified, and the slowest must take no more than `factor` times as long
+  as the fastest. Each password is hashed and verified as many times as
+  it takes to run for at least #{@min_time_us} microseconds, and the time
+  per iteration is compared, so that the check still holds for hashes
+  that are run with low-cost options and take microseconds.
+  """
+  def hash_time_bounded(module, opts \\ [], factor \\ 4) do
+    @time_sizes
+    |> Enum.map(&hash_verify_time(module, String.duplicate("a", &1), opts))
+    |> within_factor?(factor)
+  end
+
+  @doc """
+  Checks that passwords with multi-byte characters take no more than
+  `factor` times as long to hash and verify as ascii passwords with the
+  same number of bytes.
+  """
+  def multibyte_time_stable(module, opts \\ [], factor \\ 2) do
+    [String.duplicate("a", 1020), String.duplicate("ж", 510), String.duplicate("☕", 340)]
+    |> Enum.map(&hash_verify_time(module, &1, opts))
+    |> within_factor?(factor)
+  end
+
+  defp hash_verify_time(module, password, opts) do
+    fun = fn -> module.verify_pass(password, module.hash_pwd_salt(password, opts)) end
+    iterations = iterations(fun, 1)
+
+    times =
+      for _ <- 1..3 do
+        {time, _} = :timer.tc(fn -> repeat(fun, iterations) end)
+        time / iterations
+      end
+
+    times |> Enum.sort() |> Enum.at(1) |> max(1 / iterations)
+  end
+
+  # Doubles the number of iterations until they take at least @min_time_us.
+  defp iterations(fun, n) do
+    {time, _} = :timer.tc(fn -> repeat(fun, n) end)
+    if time >= @min_time_us or n >= @max_iterations, do: n, else: iterations(fun, n * 2)
+  end
+
+  defp repeat(_fun, 0), do: :ok
+
+  defp repeat(fun, n) do
+    fun.()
+    repeat(fun, n - 1)
+  end
+
+  defp within_factor?(times, factor) do
+    Enum.max(times) <= factor * Enum.min(times)
+  end
+
+  defp random_password(_kind, 0), do: ""
+
+  defp random_password(:ascii, length) do
+    for _ <- 1..length, into: "", do: <<Enum.random(?!..?~)>>
+  end
+
+  defp random_password(:unicode, length) do
+    for _ <- 1..length, into: "", do: <<Enum.random(Enum.random(@unicode_ranges))::utf8>>
+  end
+
+  defp random_password(:binary, length), do: :crypto.strong_rand_bytes(length)
+
   @doc """
   Checks that the `verify_pass/2` function returns true for correct password.
   """
-  def correct_password_true(module, password) do
-    module.verify_pass(password, module.hash_pwd_salt(password))
+  def correct_password_true(module, password, opts \\ []) do
+    module.verify_pass(password, module.hash_pwd_salt(password, opts))
   end
 
   @doc """
   Checks that the `verify_pass/2` function returns false for incorrect passwords.
   """
-  def wrong_password_false(module, password) do
-    hash = module.hash_pwd_salt(password)
+  def wrong_password_false(module, password, opts \\ []) do
+    hash = module.hash_pwd_salt(password, opts)
 
     password
     |> wrong_passwords()
-    |> Enum.all?(&(module.verify_pass(&1, hash) == false))
+    |> all_concurrently?(&(module.verify_pass(&1, hash) == false))
   end
 
   @doc """
   Checks that the `add_hash/2` function creates a map with the `password_hash` set.
   """
-  def add_hash_creates_map(module, password) do
-    %{password_hash: hash} = module.add_hash(password)
+  def add_hash_creates_map(module, password, opts \\ []) do
+    %{password_hash: hash} = module.add_hash(password, opts)
     module.verify_pass(password, hash)
   end
 
   @doc """
   Checks that the `check_pass/3` function returns the user for correct passwords.
   """
-  def check_pass_returns_user(module, password) do
-    hash = module.hash_pwd_salt(password)
+  def check_pass_returns_user(module, password, opts \\ []) do
+    hash = module.hash_pwd_salt(password, opts)
     user = %{id: 2, name: "fred", password_hash: hash}
-    module.check_pass(user, password) == {:ok, user}
+    module.check_pass(user, password, opts) == {:ok, user}
   end
 
   @doc """
   Checks that the `check_pass/3` function returns an error for incorrect passwords.
   """
-  def check_pass_returns_error(module, password) do
-    hash = module.hash_pwd_salt(password)
+  def check_pass_returns_error(module, password, opts \\ []) do
+    hash = module.hash_pwd_salt(password, opts)
     user = %{id: 2, name: "fred", password_hash: hash}
 
     password
     |> wrong_passwords()
-    |> Enum.all?(&(module.check_pass(user, &1) == {:error, "invalid password"}))
+    |> all_concurrently?(&(module.check_pass(user, &1, opts) == {:error, "invalid password"}))
   end
 
   @doc """
   Checks that the `check_pass/3` function returns an error when no user is found.
   """
-  def check_pass_nil_user(module) do
-    module.check_pass(nil, "password") == {:error, "invalid user-identifier"}
+  def check_pass_nil_user(module, opts \\ []) do
+    module.check_pass(nil, "password", opts) == {:error, "invalid user-identifier"}
+  end
+
+  defp all_concurrently?(inputs, fun) do
+    inputs
+    |> Task.async_stream(fun,
+      max_concurrency: System.schedulers_online(),
+      ordered: false,
+      timeout: :infinity
+    )
+    |> Enum.all?(&(&1 == {:ok, true}))
   end
 
   defp wrong_passwords(password) do
     words = [password, String.duplicate(password, 2)]
     reversed = Enum.map(words, &String.reverse(&1))
-    Enum.flat_map(words ++ reversed, &slices/1)
+
+    (words ++ reversed)
+    |> Enum.flat_map(&slices/1)
+    |> Enum.uniq()
   end
 
   defp slices(password) do
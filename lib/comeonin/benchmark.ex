@@ -0,0 +1,318 @@
+defmodule Comeonin.Benchmark do
+  @moduledoc """
+  Measures the cost of `Comeonin.PasswordHash` implementations on this host.
+
+  `matrix/2` sweeps a grid of options for each implementation and, for
+  every combination, measures the time it takes to verify a password and
+  an estimate of the memory used by each verification. The memory is
+  derived from the parameters of the hash (see `Comeonin.HashInfo.memory/1`),
+  as memory allocated by NIFs cannot be measured reliably from Erlang. It
+  is only sampled for unknown hash formats. These figures are
+  then combined into an estimate of the cost to an attacker of making one
+  guess, and the configurations that are Pareto-optimal (no other
+  configuration is both faster to verify and more expensive to attack)
+  are marked.
+
+  The implementations and their grids are usually set in the config:
+
+      config :comeonin, :benchmark, [
+        {Argon2, t_cost: [1, 2, 3], m_cost: [15, 16, 17]},
+        {Bcrypt, log_rounds: [10, 11, 12]},
+        {Pbkdf2, rounds: [100_000, 160_000]}
+      ]
+
+  Without this config, the `baseline/0` is benchmarked, if
+  `Comeonin.Pbkdf2Hmac` is defined. See `mix comeonin.bench` for a
+  command line interface.
+
+  ## Attacker cost
+
+  The attacker cost is a time-area product - the verify time, in
+  microseconds, multiplied by the memory used, in KiB. The memory is
+  floored at 4 KiB, which is the size of the state that bcrypt keeps,
+  so that algorithms that are not memory-hard are still ranked by time.
+  A different estimate can be given with the `:attacker_cost` option.
+  """
+
+  import Bitwise
+
+  @type grid :: keyword([term])
+  @type result :: %{
+          module: module,
+          opts: keyword,
+          prefix: binary | nil,
+          verify_us: non_neg_integer,
+          memory: non_neg_integer,
+          attacker_cost: number,
+          pareto: boolean
+        }
+
+  @password "correct horse battery staple"
+  @memory_floor 4096
+
+  @doc """
+  Benchmarks every combination of options for each `{module, grid}`.
+
+  ## Options
+
+    * `:runs` - the number of verifications that are timed for each configuration
+      * the median time is reported
+      * the default is 5
+    * `:attacker_cost` - a function that takes the verify time, in microseconds,
+      and the memory, in bytes, and returns the estimated attacker cost
+  """
+  @spec matrix([{module, grid}], keyword) :: [result]
+  def matrix(specs, opts \\ []) do
+    results =
+      for {module, grid} <- specs, hash_opts <- expand_grid(grid) do
+        measure(module, hash_opts, opts)
+      end
+
+    mark_pareto(results)
+  end
+
+  @doc """
+  Returns the benchmark specs set in the config, or the baseline if the
+  `:benchmark` config is not set and the baseline is available.
+  """
+  @spec configured() :: [{module, grid}]
+  def configured do
+    default =
+      case baseline() do
+        {module, opts} -> [{module, Enum.map(opts, &grid_param/1)}]
+        nil -> []
+      end
+
+    Application.get_env(:comeonin, :benchmark, default)
+  end
+
+  defp grid_param({key, value}), do: {key, [value]}
+
+  @doc """
+  Returns the implementation and options that other configurations are
+  compared against.
+
+  This is `Comeonin.Pbkdf2Hmac` with its default options, which needs no
+  dependencies, so the same baseline can be measured on any host. It is
+  nil if `Comeonin.Pbkdf2Hmac` is not defined, that is, before OTP 24.2.
+  """
+  @spec baseline() :: {module, keyword} | nil
+  def baseline do
+    if Code.ensure_loaded?(Comeonin.Pbkdf2Hmac) do
+      {Comeonin.Pbkdf2Hmac, [digest: :sha512, rounds: 160_000]}
+    end
+  end
+
+  @doc """
+  Expands a grid of option values into a list of option combinations.
+
+  ## Examples
+
+      iex> Comeonin.Benchmark.expand_grid(t_cost: [1, 2], m_cost: [16])
+      [[t_cost: 1, m_cost: 16], [t_cost: 2, m_cost: 16]]
+
+  """
+  @spec expand_grid(grid) :: [keyword]
+  def expand_grid(grid) do
+    grid
+    |> Enum.reverse()
+    |> Enum.reduce([[]], fn {key, values}, acc ->
+      for value <- List.wrap(values), opts <- acc, do: [{key, value} | opts]
+    end)
+  end
+
+  @doc """
+  Measures a single configuration.
+  """
+  @spec measure(module, keyword, keyword) :: result
+  def measure(module, hash_opts, opts \\ []) do
+    runs = Keyword.get(opts, :runs, 5)
+    cost_fun = Keyword.get(opts, :attacker_cost, &attacker_cost/2)
+    hash = module.hash_pwd_salt(@password, hash_opts)
+
+    verify_us =
+      fn -> module.verify_pass(@password, hash) end
+      |> time_runs(runs)
+      |> median()
+
+    memory =
+      Comeonin.HashInfo.memory(hash) ||
+        peak_memory(fn -> module.verify_pass(@password, hash) end)
+
+    %{
+      module: module,
+      opts: hash_opts,
+      prefix: Comeonin.HashInfo.prefix(hash),
+      verify_us: verify_us,
+      memory: memory,
+      attacker_cost: cost_fun.(verify_us, memory),
+      pareto: false
+    }
+  end
+
+  @doc """
+  The default attacker cost estimate.
+  """
+  @spec attacker_cost(non_neg_integer, non_neg_integer) :: float
+  def attacker_cost(verify_us, memory) do
+    verify_us * max(memory, @memory_floor) / 1024
+  end
+
+  @doc """
+  Sets `:pareto` to true for each result that is not dominated by another
+  result, that is, for which no other configuration is at least as fast
+  to verify and at least as costly to attack, and better at one of them.
+  """
+  @spec mark_pareto([result]) :: [result]
+  def mark_pareto(results) do
+    Enum.map(results, fn result ->
+      %{result | pareto: not Enum.any?(results, &dominates?(&1, result))}
+    end)
+  end
+
+  defp dominates?(a, b) do
+    a.verify_us <= b.verify_us and a.attacker_cost >= b.attacker_cost and
+      (a.verify_us < b.verify_us or a.attacker_cost > b.attacker_cost)
+  end
+
+  @doc """
+  Benchmarks `Comeonin.SecureCompare.equal?/2`, against a byte-at-a-time
+  comparison.
+
+  For each size, the binaries are compared when they are equal, when
+  they differ in the first byte and when they differ in the last byte -
+  the three times should be the same. Returns the mean time of a
+  comparison, in nanoseconds.
+
+  ## Options
+
+    * `:sizes` - the sizes of the binaries, in bytes
+      * the default is `[16, 32, 64, 256]`
+    * `:iterations` - the number of comparisons timed for each case
+      * the default is 100_000
+  """
+  @spec secure_compare(keyword) :: [map]
+  def secure_compare(opts \\ []) do
+    iterations = Keyword.get(opts, :iterations, 100_000)
+
+    for size <- Keyword.get(opts, :sizes, [16, 32, 64, 256]) do
+      left = :crypto.strong_rand_bytes(size)
+      <<first, rest::binary>> = left
+      prefix_size = size - 1
+      <<prefix::binary-size(prefix_size), last>> = left
+
+      cases = [
+        equal: :binary.copy(left),
+        first_differs: <<bxor_byte(first), rest::binary>>,
+        last_differs: <<prefix::binary, bxor_byte(last)>>
+      ]
+
+      times =
+        for {name, right} <- cases, {impl, fun} <- compare_funs() do
+          {{impl, name}, time_compare(fun, left, right, iterations)}
+        end
+
+      Map.merge(%{size: size}, Map.new(times))
+    end
+  end
+
+  defp compare_funs do
+    [secure: &Comeonin.SecureCompare.equal?/2, bytewise: &bytewise_equal?/2]
+  end
+
+  defp bxor_byte(byte), do: 255 - byte
+
+  defp time_compare(fun, left, right, iterations) do
+    {time, _} = :timer.tc(fn -> compare_loop(fun, left, right, iterations) end)
+    time * 1000 / iterations
+  end
+
+  defp compare_loop(_fun, _left, _right, 0), do: :ok
+
+  defp compare_loop(fun, left, right, n) do
+    fun.(left, right)
+    compare_loop(fun, left, right, n - 1)
+  end
+
+  # The byte-at-a-time comparison that implementations have used, as a
+  # baseline.
+  defp bytewise_equal?(left, right) when byte_size(left) == byte_size(right) do
+    bytewise_compare(left, right, 0) == 0
+  end
+
+  defp bytewise_equal?(_left, _right), do: false
+
+  defp bytewise_compare(<<x, left::binary>>, <<y, right::binary>>, acc) do
+    bytewise_compare(left, right, acc ||| bxor(x, y))
+  end
+
+  defp bytewise_compare(<<>>, <<>>, acc), do: acc
+
+  @doc """
+  Writes the results to a tab-separated costs file.
+
+  This file can be read by `read_costs/1`, and it is used by the
+  `mix comeonin.inventory` and `mix comeonin.capacity` tasks.
+  """
+  @spec write_costs(Path.t(), [result]) :: :ok
+  def write_costs(path, results) do
+    lines =
+      for %{prefix: prefix} = result <- results, prefix do
+        [prefix, result.verify_us, result.memory, inspect(result.module), inspect(result.opts)]
+        |> Enum.join("\t")
+        |> Kernel.<>("\n")
+      end
+
+    File.write!(path, ["# prefix\tverify_us\tmemory\tmodule\topts\n" | lines])
+  end
+
+  @doc """
+  Reads a costs file, returning a map of hash prefix to cost.
+  """
+  @spec read_costs(Path.t()) :: %{binary => %{verify_us: integer, memory: integer}}
+  def read_costs(path) do
+    path
+    |> File.stream!()
+    |> Stream.reject(&String.starts_with?(&1, "#"))
+    |> Stream.map(&String.split(String.trim_trailing(&1, "\n"), "\t"))
+    |> Enum.reduce(%{}, fn [prefix, verify_us, memory | _], acc ->
+      cost = %{verify_us: String.to_integer(verify_us), memory: String.to_integer(memory)}
+      Map.put(acc, prefix, cost)
+    end)
+  end
+
+  defp time_runs(fun, runs) do
+    for _ <- 1..runs do
+      {time, _} = :timer.tc(fun)
+      time
+    end
+  end
+
+  defp median(times) do
+    Enum.at(Enum.sort(times), div(length(times), 2))
+  end
+
+  # The fallback for unknown formats. The memory used by native code is
+  # not attributed to any process, so the total VM memory is sampled while
+  # the function runs - this misses memory that NIFs allocate with malloc,
+  # and verifications that finish between samples.
+  defp peak_memory(fun) do
+    :erlang.garbage_collect()
+    baseline = :erlang.memory(:total)
+    sampler = spawn_link(fn -> sample_memory(baseline) end)
+    fun.()
+    send(sampler, {:stop, self()})
+
+    receive do
+      {:peak, peak} -> max(peak - baseline, 0)
+    end
+  end
+
+  defp sample_memory(peak) do
+    receive do
+      {:stop, from} -> send(from, {:peak, max(peak, :erlang.memory(:total))})
+    after
+      1 -> sample_memory(max(peak, :erlang.memory(:total)))
+    end
+  end
+end
@@ -0,0 +1,218 @@
+defmodule Comeonin.Capacity do
+  @moduledoc """
+  Plans the capacity needed to verify logins at a target rate.
+
+  The plan combines the verify cost of each set of hash parameters,
+  measured on this host by `mix comeonin.bench`, with the number of
+  stored hashes that use each set, counted by `mix comeonin.inventory`.
+  Each stored hash is assumed to be equally likely to log in.
+
+  Logins are modelled as an M/M/c queue - Poisson arrivals, served by `c`
+  dirty CPU schedulers, each of which needs a core while it hashes. The
+  planned `c` is the smallest one for which the p99 latency (the p99
+  verify time plus the p99 wait for a scheduler, from the Erlang C
+  formula) is within the target. Adding the two percentiles overestimates
+  the p99 latency slightly, which errs on the safe side.
+
+  What-if questions, such as "what if the Argon2 `t` is raised to 4", are
+  answered by changing the parameters of the inventory with `what_if/2`
+  before planning. Parameters that have not been benchmarked get an
+  estimated cost (see `plan/3`). See `mix comeonin.capacity` for a command
+  line interface.
+  """
+
+  @type change :: {algorithm :: String.t(), param :: String.t(), value :: integer}
+
+  @doc """
+  Plans the dirty schedulers, cores and memory needed for a login rate.
+
+  `inventory` is returned by `Comeonin.Inventory.scan/2` or
+  `Comeonin.Inventory.read/1`, and `costs` by
+  `Comeonin.Benchmark.read_costs/1`.
+
+  If there is no cost for a set of parameters, it is scaled from the cost
+  of another set of parameters for the same algorithm - by 2^Δcost for
+  bcrypt, by `t * m` for Argon2 (with the memory scaled by `m`) and by the
+  number of rounds for pbkdf2. Parameters of an algorithm with no costs
+  at all are listed as missing, and left out of the plan.
+
+  ## Options
+
+    * `:qps` - the target number of logins per second (required)
+    * `:p99_ms` - the p99 latency target, in milliseconds (required)
+
+  Returns an error if the p99 verify time alone is above the target, or
+  if none of the hashes have a cost.
+  """
+  @spec plan(Comeonin.Inventory.t(), map, keyword) :: {:ok, map} | {:error, String.t()}
+  def plan(inventory, costs, opts) do
+    qps = Keyword.fetch!(opts, :qps)
+    target_us = Keyword.fetch!(opts, :p99_ms) * 1000
+    {entries, estimated, missing} = costed_entries(inventory, costs)
+    total = entries |> Enum.map(& &1.count) |> Enum.sum()
+
+    if total == 0 do
+      {:error, "none of the hashes have a cost"}
+    else
+      entries = Enum.map(entries, &Map.put(&1, :share, &1.count / total))
+      service_us = entries |> Enum.map(&(&1.share * &1.verify_us)) |> Enum.sum()
+      service_p99_us = weighted_percentile(entries, 0.99)
+      load = qps * service_us / 1_000_000
+
+      if service_p99_us > target_us do
+        {:error, "the p99 verify time of #{div(service_p99_us, 1000)} ms is above the target"}
+      else
+        servers = servers(load, service_us, service_p99_us, target_us)
+        per_hash_memory = entries |> Enum.map(& &1.memory) |> Enum.max()
+
+        {:ok,
+         %{
+           qps: qps,
+           mean_verify_us: round(service_us),
+           p99_verify_us: service_p99_us,
+           load: load,
+           dirty_cpu_schedulers: servers,
+           cores: servers,
+           utilization: load / servers,
+           wait_probability: erlang_c(servers, load),
+           p99_us: round(service_p99_us + wait_p99_us(servers, load, service_us)),
+           per_hash_memory: per_hash_memory,
+           memory: servers * per_hash_memory,
+           entries: Enum.sort_by(entries, &(-&1.count)),
+           estimated: Enum.sort(estimated),
+           missing: Enum.sort(missing)
+         }}
+      end
+    end
+  end
+
+  @doc """
+  Changes a parameter of every hash of an algorithm in an inventory.
+
+  ## Examples
+
+      iex> inventory = %{"$2b$10" => %{algorithm: "2b", params: %{"cost" => 10}, count: 3}}
+      iex> Comeonin.Capacity.what_if(inventory, [{"2b", "cost", 12}])
+      %{"$2b$12" => %{algorithm: "2b", params: %{"cost" => 12}, count: 3}}
+
+  """
+  @spec what_if(Comeonin.Inventory.t(), [change]) :: Comeonin.Inventory.t()
+  def what_if(inventory, changes) do
+    Enum.reduce(changes, inventory, fn {algorithm, param, value}, inventory ->
+      Enum.reduce(inventory, %{}, fn
+        {prefix, %{algorithm: ^algorithm} = entry}, acc ->
+          params = Map.put(entry.params, param, value)
+          new = %{entry | params: params}
+          Comeonin.Inventory.merge(acc, %{Comeonin.HashInfo.put_params(prefix, params) => new})
+
+        {key, other}, acc ->
+          Comeonin.Inventory.merge(acc, %{key => other})
+      end)
+    end)
+  end
+
+  @doc """
+  Parses a what-if change, such as `"argon2id:t=4"`.
+  """
+  @spec parse_change(binary) :: {:ok, change} | :error
+  def parse_change(change) do
+    with [algorithm, param] <- String.split(change, ":", parts: 2),
+         [key, value] <- String.split(param, "=", parts: 2),
+         {value, ""} <- Integer.parse(value) do
+      {:ok, {algorithm, key, value}}
+    else
+      _ -> :error
+    end
+  end
+
+  @doc """
+  Returns the probability that a login waits for a dirty scheduler, for
+  `servers` schedulers and an offered load of `load` (in Erlangs).
+  """
+  @spec erlang_c(pos_integer, number) :: float
+  def erlang_c(servers, load) when load >= servers, do: 1.0
+
+  def erlang_c(servers, load) do
+    # Erlang B by recurrence, which does not overflow for large values
+    b = Enum.reduce(1..servers, 1.0, fn k, b -> load * b / (k + load * b) end)
+    servers * b / (servers - load * (1 - b))
+  end
+
+  defp servers(load, service_us, service_p99_us, target_us) do
+    Stream.iterate(max(trunc(load) + 1, 1), &(&1 + 1))
+    |> Enum.find(&(service_p99_us + wait_p99_us(&1, load, service_us) <= target_us))
+  end
+
+  # In an M/M/c queue, P(wait > t) = C * exp(-(c - load) * t / service)
+  defp wait_p99_us(servers, load, service_us) do
+    c = erlang_c(servers, load)
+    if c <= 0.01, do: 0.0, else: service_us / (servers - load) * :math.log(c / 0.01)
+  end
+
+  defp weighted_percentile(entries, p) do
+    entries
+    |> Enum.sort_by(& &1.verify_us)
+    |> Enum.reduce_while(0.0, fn entry, acc ->
+      acc = acc + entry.share
+      if acc >= p - 1.0e-9, do: {:halt, {:found, entry.verify_us}}, else: {:cont, acc}
+    end)
+    |> case do
+      {:found, verify_us} -> verify_us
+      _ -> entries |> Enum.map(& &1.verify_us) |> Enum.max()
+    end
+  end
+
+  defp costed_entries(inventory, costs) do
+    references = Enum.reduce(costs, %{}, &add_reference/2)
+
+    inventory
+    |> Map.delete(:unknown)
+    |> Enum.reduce({[], [], []}, fn {prefix, entry}, {entries, estimated, missing} ->
+      entry = Map.put(entry, :prefix, prefix)
+
+      case {costs, Map.get(references, entry.algorithm)} do
+        {%{^prefix => cost}, _} ->
+          {[Map.merge(entry, cost) | entries], estimated, missing}
+
+        {_, {_, params, cost}} ->
+          scaled = Map.merge(entry, scale(entry, params, cost))
+          {[scaled | entries], [prefix | estimated], missing}
+
+        {_, nil} ->
+          {entries, estimated, [prefix | missing]}
+      end
+    end)
+  end
+
+  # The reference for each algorithm is the cost with the smallest prefix,
+  # so that the estimates do not depend on the order of the costs.
+  defp add_reference({prefix, cost}, acc) do
+    case Comeonin.HashInfo.parse_prefix(prefix) do
+      {:ok, %{algorithm: algorithm, params: params}} ->
+        Map.update(acc, algorithm, {prefix, params, cost}, fn
+          {old, _, _} = current when old < prefix -> current
+          _ -> {prefix, params, cost}
+        end)
+
+      :error ->
+        acc
+    end
+  end
+
+  defp scale(%{params: %{"cost" => cost}}, %{"cost" => ref}, reference) do
+    %{reference | verify_us: round(reference.verify_us * :math.pow(2, cost - ref))}
+  end
+
+  defp scale(%{params: %{"m" => m, "t" => t}}, %{"m" => ref_m, "t" => ref_t}, reference) do
+    %{
+      verify_us: round(reference.verify_us * t * m / (ref_t * ref_m)),
+      memory: round(reference.memory * m / ref_m)
+    }
+  end
+
+  defp scale(%{params: %{"rounds" => rounds}}, %{"rounds" => ref}, reference) do
+    %{reference | verify_us: round(reference.verify_us * rounds / ref)}
+  end
+
+  defp scale(_entry, _params, reference), do: reference
+end
@@ -0,0 +1,106 @@
+defmodule Comeonin.CostProfile do
+  @moduledoc """
+  Applies a global cost profile to the `hash_pwd_salt/2` function of every
+  `use Comeonin` module.
+
+  Password hashing is designed to be slow, which makes test suites that
+  create users slow as well. Setting the `:test` cost profile, in the
+  `config/test.exs` file, makes every implementation use its lowest-cost
+  options:
+
+      config :comeonin, cost_profile: :test
+
+  The options for a profile are taken from the `cost_opts/1` callback of
+  the implementation, if it is defined. Otherwise, the built-in options
+  for Argon2, Bcrypt and Pbkdf2 are used. The profile options override
+  any options passed to `hash_pwd_salt/2`.
+
+  The profile is read once, when the `:comeonin` application starts, so
+  when no profile is set, the cost to each hash is one `:persistent_term`
+  lookup.
+
+  The `:test` profile must never be used in production. If it is set
+  when the `:comeonin` application starts and Mix is not running, or
+  the Mix environment is `:prod`, the application raises.
+  """
+
+  @key {__MODULE__, :profile}
+
+  @test_opts %{
+    Argon2 => [t_cost: 1, m_cost: 8],
+    Bcrypt => [log_rounds: 4],
+    Pbkdf2 => [rounds: 1]
+  }
+
+  @doc """
+  Returns the current cost profile, or nil if none is set.
+  """
+  @spec profile() :: atom | nil
+  def profile do
+    :persistent_term.get(@key, nil)
+  end
+
+  @doc """
+  Reads the cost profile from the config and makes it the current profile.
+
+  This is called when the `:comeonin` application starts. It raises if
+  the `:test` profile is set in production (see `check!/2`).
+  """
+  @spec load() :: :ok
+  def load do
+    profile = Application.get_env(:comeonin, :cost_profile)
+    check!(profile)
+    :persistent_term.put(@key, profile)
+  end
+
+  @doc """
+  Merges the options of the current cost profile, if any, into `opts`.
+  """
+  @spec opts(module, keyword) :: keyword
+  def opts(module, opts) do
+    case profile() do
+      nil -> opts
+      profile -> Keyword.merge(opts, profile_opts(module, profile))
+    end
+  end
+
+  @doc """
+  Returns the options that `module` uses for `profile`.
+  """
+  @spec profile_opts(module, atom) :: keyword
+  def profile_opts(module, profile) do
+    if function_exported?(module, :cost_opts, 1) do
+      module.cost_opts(profile)
+    else
+      builtin_opts(module, profile)
+    end
+  end
+
+  defp builtin_opts(module, :test), do: Map.get(@test_opts, module, [])
+  defp builtin_opts(_module, _profile), do: []
+
+  @doc """
+  Raises if `profile` is the `:test` cost profile and `production` is true.
+
+  By default, this is a production environment if Mix is not running,
+  or the Mix environment is `:prod`.
+  """
+  @spec check!(atom | nil, boolean) :: :ok
+  def check!(profile, production \\ production?()) do
+    if profile == :test and production do
+      raise ArgumentError, """
+      the :test cost profile is set, but this is a production environment.
+
+      With this profile, passwords are hashed with the lowest-cost options,
+      which offer almost no protection. Remove `cost_profile: :test` from
+      the :comeonin config for this environment.
+      """
+    end
+
+    :ok
+  end
+
+  defp production? do
+    not Code.ensure_loaded?(Mix) or Mix.env() == :prod
+  end
+end
@@ -0,0 +1,185 @@
+defmodule Comeonin.HashInfo do
+  @moduledoc """
+  Parses the algorithm and cost parameters out of a password hash.
+
+  Only the parameters are extracted - the salt and the checksum are
+  ignored, which means that the result can be logged or aggregated
+  without leaking anything about the password.
+
+  The formats produced by argon2_elixir, bcrypt_elixir and pbkdf2_elixir
+  are supported.
+  """
+
+  @type t :: %{algorithm: String.t(), params: %{optional(String.t()) => integer}, prefix: binary}
+
+  @doc """
+  Returns the algorithm, the parameters and the parameter prefix of a hash.
+
+  The prefix is the part of the hash before the salt, and it identifies
+  the cost of verifying the hash.
+
+  ## Examples
+
+      iex> Comeonin.HashInfo.parse("$argon2id$v=19$m=65536,t=3,p=4$c2FsdA$aGFzaA")
+      {:ok,
+       %{
+         algorithm: "argon2id",
+         params: %{"m" => 65536, "p" => 4, "t" => 3},
+         prefix: "$argon2id$v=19$m=65536,t=3,p=4"
+       }}
+
+  """
+  @spec parse(binary) :: {:ok, t} | :error
+  def parse("$argon2" <> _ = hash) do
+    with ["", alg, "v=" <> _ = version, params, _salt, _checksum] <- split(hash),
+         {:ok, parsed} <- argon2_params(params) do
+      {:ok, info(alg, parsed, ["", alg, version, params])}
+    else
+      _ -> :error
+    end
+  end
+
+  def parse(<<"$2", minor, "$", cost::binary-2, "$", _::binary-53>>) when minor in 'aby' do
+    alg = <<"2", minor>>
+
+    case Integer.parse(cost) do
+      {value, ""} -> {:ok, info(alg, %{"cost" => value}, ["", alg, cost])}
+      _ -> :error
+    end
+  end
+
+  def parse("$pbkdf2-" <> _ = hash) do
+    with ["", "pbkdf2-" <> _ = alg, rounds, _salt, _checksum] <- split(hash),
+         {rounds, ""} <- Integer.parse(rounds) do
+      {:ok, info(alg, %{"rounds" => rounds}, ["", alg, Integer.to_string(rounds)])}
+    else
+      _ -> :error
+    end
+  end
+
+  def parse("pbkdf2_" <> _ = hash) do
+    with ["pbkdf2_" <> _ = alg, rounds, _salt, _checksum] <- split(hash),
+         {rounds, ""} <- Integer.parse(rounds) do
+      {:ok, info(alg, %{"rounds" => rounds}, [alg, Integer.to_string(rounds)])}
+    else
+      _ -> :error
+    end
+  end
+
+  def parse(_), do: :error
+
+  @doc """
+  Parses a parameter prefix, as returned by `prefix/1`.
+  """
+  @spec parse_prefix(binary) :: {:ok, t} | :error
+  def parse_prefix(prefix) do
+    with :error <- parse(prefix <> "$c2FsdA$aGFzaA") do
+      parse(prefix <> "$" <> String.duplicate("a", 53))
+    end
+  end
+
+  @doc """
+  Returns the parameter prefix of a hash, or nil if the format is unknown.
+  """
+  @spec prefix(binary) :: binary | nil
+  def prefix(hash) when is_binary(hash) do
+    case parse(hash) do
+      {:ok, %{prefix: prefix}} -> prefix
+      :error -> nil
+    end
+  end
+
+  def prefix(_), do: nil
+
+  @doc """
+  Returns an estimate of the memory, in bytes, used to verify a hash, or
+  nil if the format is unknown.
+
+  The estimate comes from the parameters of the hash:
+
+    * Argon2 - the memory matrix, `m` KiB
+    * bcrypt - the S-boxes and subkeys, 4168 bytes
+    * Pbkdf2 - the HMAC state, which is well under 1 KiB
+
+  This is memory that NIFs allocate outside of the Erlang heaps, so it is
+  not seen by `:erlang.memory/1`.
+
+  ## Examples
+
+      iex> Comeonin.HashInfo.memory("$argon2id$v=19$m=65536,t=3,p=4$c2FsdA$aGFzaA")
+      67108864
+
+      iex> Comeonin.HashInfo.memory("not a hash")
+      nil
+
+  """
+  @spec memory(binary) :: non_neg_integer | nil
+  def memory(hash) do
+    case parse(hash) do
+      {:ok, %{algorithm: "argon2" <> _, params: %{"m" => m}}} -> m * 1024
+      {:ok, %{algorithm: "2" <> _}} -> 4168
+      {:ok, %{algorithm: "pbkdf2" <> _}} -> 512
+      _ -> nil
+    end
+  end
+
+  @doc """
+  Returns a parameter prefix with some of its parameters changed.
+
+  ## Examples
+
+      iex> Comeonin.HashInfo.put_params("$argon2id$v=19$m=65536,t=3,p=4", %{"t" => 4})
+      "$argon2id$v=19$m=65536,t=4,p=4"
+
+      iex> Comeonin.HashInfo.put_params("$2b$10", %{"cost" => 12})
+      "$2b$12"
+
+  """
+  @spec put_params(binary, %{optional(String.t()) => integer}) :: binary
+  def put_params("$argon2" <> _ = prefix, params) do
+    ["", alg, version, old] = split(prefix)
+
+    pairs =
+      old
+      |> String.split(",")
+      |> Enum.map(fn param ->
+        [key, value] = String.split(param, "=")
+        {key, Map.get(params, key, value)}
+      end)
+
+    pairs = pairs ++ Enum.sort(Map.drop(params, Enum.map(pairs, &elem(&1, 0))))
+    joined = Enum.map_join(pairs, ",", fn {key, value} -> "#{key}=#{value}" end)
+    Enum.join(["", alg, version, joined], "$")
+  end
+
+  def put_params(<<"$2", minor, "$", cost::binary-2>>, params) do
+    cost = params |> Map.get("cost", cost) |> to_string() |> String.pad_leading(2, "0")
+    <<"$2", minor, "$", cost::binary>>
+  end
+
+  def put_params(prefix, %{"rounds" => rounds}) do
+    old = prefix |> split() |> List.last()
+    String.replace_suffix(prefix, old, Integer.to_string(rounds))
+  end
+
+  def put_params(prefix, _params), do: prefix
+
+  defp info(alg, params, prefix) do
+    %{algorithm: alg, params: params, prefix: Enum.join(prefix, "$")}
+  end
+
+  defp split(hash), do: :binary.split(hash, "$", [:global])
+
+  defp argon2_params(params) do
+    params
+    |> String.split(",")
+    |> Enum.reduce_while({:ok, %{}}, fn param, {:ok, acc} ->
+      with [key, value] <- String.split(param, "="),
+           {value, ""} <- Integer.parse(value) do
+        {:cont, {:ok, Map.put(acc, key, value)}}
+      else
+        _ -> {:halt, :error}
+      end
+    end)
+  end
+end
@@ -0,0 +1,143 @@
+defmodule Comeonin.Inventory do
+  @moduledoc """
+  Counts the algorithms and parameters of stored password hashes.
+
+  The hashes are parsed with `Comeonin.HashInfo` - nothing is verified,
+  so scanning even hundreds of millions of hashes is fast. The input is
+  streamed in chunks, which are parsed concurrently, and only the counts
+  for each distinct set of parameters are kept, so the memory used does
+  not depend on the size of the input.
+
+  Combined with a costs file from `mix comeonin.bench`, the inventory
+  gives the CPU time needed to verify the stored hashes (see
+  `project/2`). See `mix comeonin.inventory` for a command line interface.
+  """
+
+  @type entry :: %{algorithm: String.t(), params: map, count: non_neg_integer}
+  @type t :: %{optional(binary) => entry, optional(:unknown) => non_neg_integer}
+
+  @doc """
+  Counts the hashes in an enumerable of lines.
+
+  ## Options
+
+    * `:column` - the 0-based column of the hash, for delimited input
+      * by default, the whole line is the hash
+    * `:separator` - the column separator
+      * the default is `","`
+    * `:chunk_size` - the number of lines parsed by each task
+      * the default is 10_000
+    * `:max_concurrency` - the number of chunks parsed at the same time
+      * the default is the number of online schedulers
+  """
+  @spec scan(Enumerable.t(), keyword) :: t
+  def scan(lines, opts \\ []) do
+    column = Keyword.get(opts, :column)
+    separator = Keyword.get(opts, :separator, ",")
+
+    lines
+    |> Stream.chunk_every(Keyword.get(opts, :chunk_size, 10_000))
+    |> Task.async_stream(&count_chunk(&1, column, separator),
+      max_concurrency: Keyword.get(opts, :max_concurrency, System.schedulers_online()),
+      ordered: false,
+      timeout: :infinity
+    )
+    |> Enum.reduce(%{}, fn {:ok, counts}, acc -> merge(acc, counts) end)
+  end
+
+  defp count_chunk(lines, column, separator) do
+    Enum.reduce(lines, %{}, fn line, acc ->
+      case line |> extract(column, separator) |> Comeonin.HashInfo.parse() do
+        {:ok, %{prefix: prefix} = info} ->
+          entry = %{algorithm: info.algorithm, params: info.params, count: 1}
+          Map.update(acc, prefix, entry, &%{&1 | count: &1.count + 1})
+
+        :error ->
+          if blank?(line), do: acc, else: Map.update(acc, :unknown, 1, &(&1 + 1))
+      end
+    end)
+  end
+
+  defp extract(line, nil, _separator), do: unquote_field(line)
+
+  defp extract(line, column, separator) do
+    line |> String.split(separator) |> Enum.at(column, "") |> unquote_field()
+  end
+
+  defp unquote_field(field), do: field |> String.trim() |> String.trim("\"")
+
+  defp blank?(line), do: String.trim(line) == ""
+
+  @doc """
+  Merges two inventories.
+  """
+  @spec merge(t, t) :: t
+  def merge(a, b) do
+    Map.merge(a, b, fn
+      :unknown, x, y -> x + y
+      _prefix, x, y -> %{x | count: x.count + y.count}
+    end)
+  end
+
+  @doc """
+  Projects the CPU time needed to verify the stored hashes.
+
+  `costs` is a map of hash prefix to cost, as returned by
+  `Comeonin.Benchmark.read_costs/1`. Returns the CPU-seconds needed for
+  1000 logins, if each stored hash is equally likely to log in, and the
+  prefixes that have no cost.
+  """
+  @spec project(t, map) :: %{cpu_seconds_per_1k: float, covered: float, missing: [binary]}
+  def project(inventory, costs) do
+    entries = Map.delete(inventory, :unknown)
+    total = entries |> Map.values() |> Enum.map(& &1.count) |> Enum.sum()
+
+    {weighted_us, covered, missing} =
+      Enum.reduce(entries, {0, 0, []}, fn {prefix, %{count: count}}, {us, covered, missing} ->
+        case costs do
+          %{^prefix => %{verify_us: cost}} -> {us + count * cost, covered + count, missing}
+          _ -> {us, covered, [prefix | missing]}
+        end
+      end)
+
+    %{
+      cpu_seconds_per_1k: if(covered > 0, do: weighted_us / covered / 1000, else: 0.0),
+      covered: if(total > 0, do: covered / total, else: 0.0),
+      missing: Enum.sort(missing)
+    }
+  end
+
+  @doc """
+  Writes an inventory to a tab-separated file.
+  """
+  @spec write(Path.t(), t) :: :ok
+  def write(path, inventory) do
+    lines =
+      for {prefix, %{algorithm: algorithm, count: count}} <- Enum.sort(inventory) do
+        [prefix, "\t", algorithm, "\t", Integer.to_string(count), "\n"]
+      end
+
+    unknown = ["unknown\t-\t", Integer.to_string(Map.get(inventory, :unknown, 0)), "\n"]
+    File.write!(path, ["# prefix\talgorithm\tcount\n", lines, unknown])
+  end
+
+  @doc """
+  Reads an inventory file written by `write/2`.
+  """
+  @spec read(Path.t()) :: t
+  def read(path) do
+    path
+    |> File.stream!()
+    |> Stream.reject(&String.starts_with?(&1, "#"))
+    |> Stream.map(&String.split(String.trim_trailing(&1, "\n"), "\t"))
+    |> Enum.reduce(%{}, fn
+      ["unknown", _, count], acc ->
+        Map.put(acc, :unknown, String.to_integer(count))
+
+      [prefix, algorithm, count], acc ->
+        {:ok, %{params: params}} = Comeonin.HashInfo.parse_prefix(prefix)
+        entry = %{algorithm: algorithm, params: params, count: String.to_integer(count)}
+        Map.put(acc, prefix, entry)
+    end)
+  end
+end
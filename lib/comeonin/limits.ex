@@ -0,0 +1,146 @@
+defmodule Comeonin.Limits do
+  @moduledoc """
+  Reads the CPU and memory limits of the container that the VM runs in.
+
+  The number of schedulers that the VM starts is based on the number of
+  cores of the host, not on the CPU quota of the container, so a hashing
+  pool sized from the schedulers can run many more hashes at the same
+  time than the quota allows. This module reads the cgroup v2 (or v1)
+  CPU quota and memory limit, and derives the hashing concurrency and
+  memory budget from them.
+  """
+
+  @cgroup_root "/sys/fs/cgroup"
+  # cgroup v1 reports "no limit" as a page-aligned value close to 2^63
+  @unlimited 0x1000000000000000
+
+  @type limits :: %{
+          source: :cgroup_v2 | :cgroup_v1 | :none,
+          cpu_quota: float | nil,
+          memory_limit: non_neg_integer | nil
+        }
+
+  @doc """
+  Reads the cgroup CPU quota, in cores, and the memory limit, in bytes.
+
+  Either value is nil if there is no limit.
+  """
+  @spec read(Path.t()) :: limits
+  def read(root \\ @cgroup_root) do
+    cond do
+      File.exists?(Path.join(root, "cgroup.controllers")) -> read_v2(v2_dir(root))
+      File.dir?(Path.join(root, "cpu")) or File.dir?(Path.join(root, "memory")) -> read_v1(root)
+      true -> %{source: :none, cpu_quota: nil, memory_limit: nil}
+    end
+  end
+
+  defp v2_dir(root) do
+    with {:ok, contents} <- File.read("/proc/self/cgroup"),
+         ["0::" <> path | _] <- Enum.filter(String.split(contents, "\n"), &(&1 =~ ~r/^0::/)),
+         dir = Path.join(root, path),
+         true <- File.exists?(Path.join(dir, "cpu.max")) do
+      dir
+    else
+      _ -> root
+    end
+  end
+
+  defp read_v2(dir) do
+    cpu_quota =
+      case read_words(Path.join(dir, "cpu.max")) do
+        [quota, period] when quota != "max" -> quota(quota, period)
+        _ -> nil
+      end
+
+    memory_limit =
+      case read_words(Path.join(dir, "memory.max")) do
+        [limit] when limit != "max" -> memory(limit)
+        _ -> nil
+      end
+
+    %{source: :cgroup_v2, cpu_quota: cpu_quota, memory_limit: memory_limit}
+  end
+
+  defp read_v1(root) do
+    cpu_dir = Enum.find([Path.join(root, "cpu"), Path.join(root, "cpu,cpuacct")], &File.dir?/1)
+
+    cpu_quota =
+      with dir when is_binary(dir) <- cpu_dir,
+           [quota] <- read_words(Path.join(dir, "cpu.cfs_quota_us")),
+           [period] <- read_words(Path.join(dir, "cpu.cfs_period_us")) do
+        quota(quota, period)
+      else
+        _ -> nil
+      end
+
+    memory_limit =
+      case read_words(Path.join([root, "memory", "memory.limit_in_bytes"])) do
+        [limit] -> memory(limit)
+        _ -> nil
+      end
+
+    %{source: :cgroup_v1, cpu_quota: cpu_quota, memory_limit: memory_limit}
+  end
+
+  defp read_words(path) do
+    case File.read(path) do
+      {:ok, contents} -> String.split(contents)
+      {:error, _} -> []
+    end
+  end
+
+  defp quota(quota, period) do
+    with {quota, ""} when quota > 0 <- Integer.parse(quota),
+         {period, ""} when period > 0 <- Integer.parse(period) do
+      quota / period
+    else
+      _ -> nil
+    end
+  end
+
+  defp memory(limit) do
+    case Integer.parse(limit) do
+      {limit, ""} when limit > 0 and limit < @unlimited -> limit
+      _ -> nil
+    end
+  end
+
+  @doc """
+  Derives the hashing concurrency and memory budget from the limits.
+
+  ## Options
+
+    * `:per_hash_memory` - the memory, in bytes, that one hash uses
+      * for Argon2, this is 2^m_cost KiB
+      * if it is not set, the memory limit does not cap the concurrency
+    * `:memory_fraction` - the fraction of the memory limit that hashing can use
+      * the default is 0.5
+    * `:size` - a fixed concurrency, which overrides the derived value
+  """
+  @spec derive(limits, keyword) :: map
+  def derive(limits, opts \\ []) do
+    schedulers = System.schedulers_online()
+    dirty_cpu = :erlang.system_info(:dirty_cpu_schedulers_online)
+    cores = if q = limits.cpu_quota, do: min(schedulers, max(ceil_int(q), 1)), else: schedulers
+    memory_budget = limits.memory_limit && trunc(limits.memory_limit * fraction(opts))
+    per_hash_memory = opts[:per_hash_memory]
+
+    by_memory =
+      if memory_budget && per_hash_memory, do: max(div(memory_budget, per_hash_memory), 1)
+
+    concurrency = opts[:size] || Enum.min(Enum.reject([cores, dirty_cpu, by_memory], &is_nil/1))
+
+    Map.merge(limits, %{
+      schedulers: schedulers,
+      dirty_cpu_schedulers: dirty_cpu,
+      cores: cores,
+      memory_budget: memory_budget,
+      per_hash_memory: per_hash_memory,
+      concurrency: concurrency
+    })
+  end
+
+  defp fraction(opts), do: Keyword.get(opts, :memory_fraction, 0.5)
+
+  defp ceil_int(value), do: trunc(Float.ceil(value / 1))
+end
@@ -0,0 +1,275 @@
+defmodule Comeonin.LoadTest do
+  @moduledoc """
+  An open-loop load generator for the `check_pass/3` function.
+
+  Requests arrive on a schedule that does not depend on how quickly
+  earlier requests are served, which is how login traffic behaves in
+  production. When the implementation cannot keep up, requests queue,
+  and this shows up in the queue depth and in the corrected latencies.
+
+  Two latencies are reported for each request:
+
+    * `:service_latency` - from the time a worker picks up the request
+      until the response
+    * `:latency` - from the time the request was scheduled to arrive until
+      the response
+      * this includes the time spent queueing, so it is not affected by
+        coordinated omission
+
+  See `mix comeonin.loadtest` for a command line interface.
+  """
+
+  @type kind :: :valid | :wrong_password | :nil_user | :missing_hash | :add_hash
+  @type arrival :: {offset_us :: non_neg_integer, kind}
+
+  @password "correct horse battery staple"
+  @default_mix [valid: 70, wrong_password: 25, nil_user: 4, missing_hash: 1]
+  @percentiles [50, 90, 99, 99.9]
+
+  @doc """
+  Runs a load test against the `check_pass/3` function of `module`.
+
+  ## Options
+
+    * `:rate` - the mean number of arrivals per second
+      * the default is 10
+    * `:duration` - the length of the test, in seconds
+      * the default is 10
+    * `:arrival` - `:poisson` or `:bursty`
+      * with `:bursty`, requests arrive in batches, and the batches
+        arrive as a Poisson process with the same overall rate
+      * the default is `:poisson`
+    * `:burst_size` - the mean batch size for bursty arrivals
+      * the default is 10
+    * `:mix` - a keyword list of weights for each kind of request
+      * the default is `#{inspect(@default_mix)}`
+    * `:concurrency` - the number of requests served at the same time
+      * the default is the number of online schedulers
+    * `:hash_opts` - the options passed to `hash_pwd_salt/2` and `check_pass/3`
+    * `:arrivals` - an explicit list of `{offset_us, kind}` arrivals, which
+      replaces the generated schedule
+  """
+  @spec run(module, keyword) :: map
+  def run(module, opts \\ []) do
+    hash_opts = Keyword.get(opts, :hash_opts, [])
+    user = %{id: 1, password_hash: module.hash_pwd_salt(@password, hash_opts)}
+    request = fn kind -> request(module, user, kind, hash_opts) end
+    arrivals = Keyword.get_lazy(opts, :arrivals, fn -> arrivals(opts) end)
+    concurrency = Keyword.get(opts, :concurrency, System.schedulers_online())
+
+    owner = self()
+    dispatcher = spawn_link(fn -> start_dispatcher(owner, request, concurrency) end)
+    wall_time = scheduler_wall_time()
+    started = now_us()
+    generate(arrivals, started, dispatcher)
+
+    receive do
+      {:finished, ^dispatcher, results, depths} ->
+        elapsed = now_us() - started
+        report(results, depths, elapsed, scheduler_utilization(wall_time))
+    end
+  end
+
+  @doc """
+  Generates an arrival schedule.
+
+  This takes the `:rate`, `:duration`, `:arrival`, `:burst_size` and `:mix`
+  options described in `run/2`.
+  """
+  @spec arrivals(keyword) :: [arrival]
+  def arrivals(opts) do
+    rate = Keyword.get(opts, :rate, 10)
+    duration_us = round(Keyword.get(opts, :duration, 10) * 1_000_000)
+    mix = Keyword.get(opts, :mix, @default_mix)
+
+    burst_size =
+      case Keyword.get(opts, :arrival, :poisson) do
+        :poisson -> 1
+        :bursty -> Keyword.get(opts, :burst_size, 10)
+      end
+
+    rate
+    |> Kernel./(burst_size)
+    |> arrival_times(duration_us, burst_size, 0, [])
+    |> Enum.map(&{&1, pick(mix)})
+  end
+
+  defp arrival_times(rate, duration_us, burst_size, time, acc) do
+    time = time + round(-:math.log(1 - :rand.uniform()) / rate * 1_000_000)
+
+    if time >= duration_us do
+      Enum.reverse(acc)
+    else
+      batch = List.duplicate(time, batch_size(burst_size))
+      arrival_times(rate, duration_us, burst_size, time, batch ++ acc)
+    end
+  end
+
+  defp batch_size(mean) when mean <= 1, do: 1
+
+  defp batch_size(mean) do
+    1 + trunc(:math.log(1 - :rand.uniform()) / :math.log(1 - 1 / mean))
+  end
+
+  defp pick(mix) do
+    total = mix |> Keyword.values() |> Enum.sum()
+    pick(mix, :rand.uniform() * total)
+  end
+
+  defp pick([{kind, _}], _), do: kind
+  defp pick([{kind, weight} | _], point) when point <= weight, do: kind
+  defp pick([{_, weight} | rest], point), do: pick(rest, point - weight)
+
+  defp request(module, user, :valid, opts), do: module.check_pass(user, @password, opts)
+  defp request(module, user, :wrong_password, opts), do: module.check_pass(user, "wrong", opts)
+  defp request(module, _, :nil_user, opts), do: module.check_pass(nil, @password, opts)
+  defp request(module, _, :missing_hash, opts), do: module.check_pass(%{id: 1}, @password, opts)
+  defp request(module, _, :add_hash, opts), do: {:ok, module.add_hash(@password, opts)}
+
+  # The generator sleeps until each arrival is due. It never waits for a
+  # response, so a slow implementation cannot slow down the arrivals.
+  defp generate([], _started, dispatcher), do: send(dispatcher, :done)
+
+  defp generate([{offset, kind} | rest], started, dispatcher) do
+    intended = started + offset
+    wait = intended - now_us()
+    if wait > 1000, do: Process.sleep(div(wait, 1000))
+    send(dispatcher, {:arrival, intended, kind})
+    generate(rest, started, dispatcher)
+  end
+
+  defp start_dispatcher(owner, request, concurrency) do
+    dispatcher = self()
+    workers = for _ <- 1..concurrency, do: spawn_link(fn -> worker(dispatcher, request) end)
+
+    dispatch(%{
+      owner: owner,
+      idle: workers,
+      workers: workers,
+      queue: :queue.new(),
+      pending: 0,
+      generating: true,
+      results: [],
+      depths: []
+    })
+  end
+
+  defp dispatch(%{generating: false, pending: 0} = state) do
+    Enum.each(state.workers, &send(&1, :stop))
+    send(state.owner, {:finished, self(), state.results, state.depths})
+  end
+
+  defp dispatch(state) do
+    receive do
+      {:arrival, intended, kind} ->
+        queue = :queue.in({intended, kind}, state.queue)
+        depths = [:queue.len(queue) | state.depths]
+        dispatch(assign(%{state | queue: queue, pending: state.pending + 1, depths: depths}))
+
+      {:done, worker, result} ->
+        results = [result | state.results]
+        idle = [worker | state.idle]
+        dispatch(assign(%{state | idle: idle, pending: state.pending - 1, results: results}))
+
+      :done ->
+        dispatch(%{state | generating: false})
+    end
+  end
+
+  defp assign(%{idle: [worker | idle]} = state) do
+    case :queue.out(state.queue) do
+      {{:value, {intended, kind}}, queue} ->
+        send(worker, {:job, intended, kind})
+        assign(%{state | idle: idle, queue: queue})
+
+      {:empty, _} ->
+        state
+    end
+  end
+
+  defp assign(state), do: state
+
+  defp worker(dispatcher, request) do
+    receive do
+      {:job, intended, kind} ->
+        started = now_us()
+        outcome = elem(request.(kind), 0)
+        finished = now_us()
+        result = {kind, outcome, finished - intended, finished - started}
+        send(dispatcher, {:done, self(), result})
+        worker(dispatcher, request)
+
+      :stop ->
+        :ok
+    end
+  end
+
+  defp report(results, depths, elapsed, utilization) do
+    outcomes =
+      Enum.reduce(results, %{}, fn {kind, outcome, _, _}, acc ->
+        Map.update(acc, {kind, outcome}, 1, &(&1 + 1))
+      end)
+
+    %{
+      requests: length(results),
+      elapsed_us: elapsed,
+      throughput: length(results) * 1_000_000 / max(elapsed, 1),
+      latency: results |> Enum.map(&elem(&1, 2)) |> percentiles(),
+      service_latency: results |> Enum.map(&elem(&1, 3)) |> percentiles(),
+      queue_depth: percentiles(depths),
+      outcomes: outcomes,
+      scheduler_utilization: utilization
+    }
+  end
+
+  @doc """
+  Returns the nearest-rank percentiles, and the maximum, of a list of values.
+  """
+  @spec percentiles([number], [number]) :: map
+  def percentiles(values, percentiles \\ @percentiles)
+
+  def percentiles([], percentiles) do
+    Map.new([:max | percentiles], &{&1, 0})
+  end
+
+  def percentiles(values, percentiles) do
+    sorted = values |> Enum.sort() |> List.to_tuple()
+    count = tuple_size(sorted)
+
+    percentiles
+    |> Map.new(fn p -> {p, elem(sorted, max(trunc(Float.ceil(p * count / 100)) - 1, 0))} end)
+    |> Map.put(:max, elem(sorted, count - 1))
+  end
+
+  defp scheduler_wall_time do
+    enabled = :erlang.system_flag(:scheduler_wall_time, true)
+    {enabled, Enum.sort(:erlang.statistics(:scheduler_wall_time_all))}
+  end
+
+  defp scheduler_utilization({enabled, before}) do
+    after_ = Enum.sort(:erlang.statistics(:scheduler_wall_time_all))
+    :erlang.system_flag(:scheduler_wall_time, enabled)
+    normal = :erlang.system_info(:schedulers)
+    dirty_cpu = :erlang.system_info(:dirty_cpu_schedulers)
+
+    before
+    |> Enum.zip(after_)
+    |> Enum.group_by(fn {{id, _, _}, _} ->
+      cond do
+        id <= normal -> :normal
+        id <= normal + dirty_cpu -> :dirty_cpu
+        true -> :dirty_io
+      end
+    end)
+    |> Map.new(fn {type, samples} ->
+      {active, total} =
+        Enum.reduce(samples, {0, 0}, fn {{_, a0, t0}, {_, a1, t1}}, {active, total} ->
+          {active + a1 - a0, total + t1 - t0}
+        end)
+
+      {type, if(total > 0, do: active / total, else: 0.0)}
+    end)
+  end
+
+  defp now_us, do: System.monotonic_time(:microsecond)
+end
@@ -0,0 +1,276 @@
+defmodule Comeonin.Monitor do
+  @moduledoc """
+  Monitors the dirty CPU schedulers, and how much of their work is hashing.
+
+  Password hashing NIFs run on the dirty CPU schedulers, which they share
+  with every other CPU-bound NIF in the VM. When the dirty schedulers are
+  saturated, hashes and the other NIFs wait for each other, and the
+  scheduler statistics alone do not show which of them is the cause.
+
+  The monitor samples the busy time of the dirty CPU schedulers (using
+  `:scheduler_wall_time`) and the number of hashes that are running
+  (from `Comeonin.Pool`, or `Comeonin.Stats` if the pool is not running).
+  It keeps the periods in which the dirty schedulers were saturated, with
+  the share of the busy time that was hashing, and makes a
+  recommendation - see `report/0`. `:scheduler_wall_time` is turned on
+  while the monitor runs, and set back to its previous value when it
+  stops.
+
+  The monitor is optional. It is started by the `:comeonin` application
+  when the `:monitor` config is set:
+
+      config :comeonin, :monitor, interval: 500, threshold: 0.9
+
+  ## Options
+
+    * `:interval` - the time, in milliseconds, between samples
+      * the default is 500
+    * `:window` - the number of samples kept
+      * the default is 600
+    * `:threshold` - the dirty CPU utilization that counts as saturated
+      * the default is 0.9
+    * `:max_periods` - the number of saturation periods kept
+      * the default is 20
+  """
+
+  use GenServer
+
+  require Logger
+
+  @type recommendation :: %{
+          action: :none | :raise_dirty_cpu | :cap_hashing | :check_other_nifs,
+          value: pos_integer | nil,
+          message: String.t()
+        }
+
+  @doc false
+  def start_link(opts) do
+    GenServer.start_link(__MODULE__, opts, name: __MODULE__)
+  end
+
+  @doc """
+  Returns the utilization of the dirty CPU schedulers over the window,
+  the saturation periods and a recommendation.
+
+  The returned map contains:
+
+    * `:utilization` - the mean busy fraction of the dirty CPU schedulers
+    * `:hashing_utilization` - the mean fraction of the dirty CPU
+      schedulers that were running a hash
+    * `:saturated` - the fraction of the samples that were saturated
+    * `:hashing_share` - the share of the busy time that was hashing,
+      while saturated (or over the whole window, if it was never saturated)
+    * `:periods` - the saturation periods, most recent first
+    * `:recommendation` - see `recommend/3`
+  """
+  @spec report() :: map
+  def report do
+    GenServer.call(__MODULE__, :report)
+  end
+
+  @doc """
+  Recommends an action, given a report and the number of dirty CPU
+  schedulers and cores.
+
+    * if the dirty schedulers are rarely saturated, no action is needed
+    * if they are saturated and there are more cores than dirty
+      schedulers, raise the number of dirty schedulers (`+SDcpu`)
+    * if they are saturated mostly by hashing, cap the hashing
+      concurrency (the `:size` option of `Comeonin.Pool`), so that one
+      dirty scheduler is left for the other NIFs
+    * otherwise, the other NIFs saturate the dirty schedulers
+  """
+  @spec recommend(map, pos_integer, pos_integer) :: recommendation
+  def recommend(report, dirty_cpu, cores) do
+    share = "#{round(report.hashing_share * 100)}%"
+
+    cond do
+      report.saturated < 0.05 ->
+        %{action: :none, value: nil, message: "dirty CPU schedulers are not saturated"}
+
+      dirty_cpu < cores ->
+        %{
+          action: :raise_dirty_cpu,
+          value: cores,
+          message: "raise +SDcpu from #{dirty_cpu} to #{cores} (hashing is #{share} of the load)"
+        }
+
+      report.hashing_share >= 0.5 ->
+        cap = max(dirty_cpu - 1, 1)
+
+        %{
+          action: :cap_hashing,
+          value: cap,
+          message: "cap hashing at #{cap} (hashing is #{share} of the saturated load)"
+        }
+
+      true ->
+        %{
+          action: :check_other_nifs,
+          value: nil,
+          message: "other NIFs saturate the dirty CPU schedulers (hashing is #{share})"
+        }
+    end
+  end
+
+  @impl true
+  def init(opts) do
+    Process.flag(:trap_exit, true)
+    wall_time = :erlang.system_flag(:scheduler_wall_time, true)
+
+    config = %{
+      interval: Keyword.get(opts, :interval, 500),
+      window: Keyword.get(opts, :window, 600),
+      threshold: Keyword.get(opts, :threshold, 0.9),
+      max_periods: Keyword.get(opts, :max_periods, 20),
+      dirty_cpu: :erlang.system_info(:dirty_cpu_schedulers_online)
+    }
+
+    schedule(config)
+
+    {:ok,
+     %{
+       config: config,
+       cpu: Comeonin.Stats.dirty_cpu_time(),
+       samples: :queue.new(),
+       count: 0,
+       current: nil,
+       periods: [],
+       wall_time: wall_time
+     }}
+  end
+
+  @impl true
+  def handle_call(:report, _from, state) do
+    samples = :queue.to_list(state.samples)
+    saturated = Enum.filter(samples, & &1.saturated)
+    share_samples = if saturated == [], do: samples, else: saturated
+    cores = Comeonin.Limits.derive(Comeonin.Limits.read()).cores
+
+    report = %{
+      dirty_cpu_schedulers: state.config.dirty_cpu,
+      samples: length(samples),
+      utilization: mean(samples, & &1.utilization),
+      hashing_utilization: mean(samples, & &1.hashing),
+      saturated: if(samples == [], do: 0.0, else: length(saturated) / length(samples)),
+      hashing_share: share(share_samples),
+      periods: Enum.map(List.wrap(state.current) ++ state.periods, &period_summary/1)
+    }
+
+    recommendation = recommend(report, state.config.dirty_cpu, cores)
+    {:reply, Map.put(report, :recommendation, recommendation), state}
+  end
+
+  @impl true
+  def handle_info(:sample, %{config: config} = state) do
+    cpu = Comeonin.Stats.dirty_cpu_time()
+    schedule(config)
+
+    case utilization(state.cpu, cpu) do
+      nil ->
+        {:noreply, %{state | cpu: cpu}}
+
+      utilization ->
+        hashing = min(running_hashes(), config.dirty_cpu) / config.dirty_cpu
+        saturated = utilization >= config.threshold
+
+        sample = %{
+          at: System.system_time(:millisecond),
+          utilization: utilization,
+          hashing: hashing,
+          saturated: saturated
+        }
+
+        state = %{state | cpu: cpu} |> add_sample(sample) |> track_period(sample)
+        {:noreply, state}
+    end
+  end
+
+  def handle_info(_message, state), do: {:noreply, state}
+
+  @impl true
+  def terminate(_reason, state) do
+    :erlang.system_flag(:scheduler_wall_time, state.wall_time)
+  end
+
+  defp add_sample(%{config: config} = state, sample) do
+    samples = :queue.in(sample, state.samples)
+
+    if state.count >= config.window do
+      %{state | samples: :queue.drop(samples)}
+    else
+      %{state | samples: samples, count: state.count + 1}
+    end
+  end
+
+  defp track_period(%{current: nil} = state, %{saturated: false}), do: state
+
+  # A sample covers the interval before it, so a period starts one
+  # interval before its first sample.
+  defp track_period(%{current: nil} = state, sample) do
+    started_at = sample.at - state.config.interval
+    period = %{started_at: started_at, ended_at: sample.at, count: 0, busy: 0.0, hashing: 0.0}
+    %{state | current: extend(period, sample)}
+  end
+
+  defp track_period(%{current: current} = state, %{saturated: true} = sample) do
+    %{state | current: extend(current, sample)}
+  end
+
+  defp track_period(%{current: current, config: config} = state, _sample) do
+    period = period_summary(current)
+
+    Logger.info(
+      "Comeonin.Monitor: dirty CPU schedulers were saturated for #{period.duration_ms} ms, " <>
+        "hashing was #{round(period.hashing_share * 100)}% of the load"
+    )
+
+    %{state | current: nil, periods: Enum.take([current | state.periods], config.max_periods)}
+  end
+
+  defp extend(period, sample) do
+    %{
+      period
+      | ended_at: sample.at,
+        count: period.count + 1,
+        busy: period.busy + sample.utilization,
+        hashing: period.hashing + min(sample.hashing, sample.utilization)
+    }
+  end
+
+  defp period_summary(period) do
+    %{
+      started_at: period.started_at,
+      duration_ms: period.ended_at - period.started_at,
+      utilization: period.busy / period.count,
+      hashing_share: if(period.busy > 0, do: period.hashing / period.busy, else: 0.0)
+    }
+  end
+
+  defp share(samples) do
+    busy = samples |> Enum.map(& &1.utilization) |> Enum.sum()
+    hashing = samples |> Enum.map(&min(&1.hashing, &1.utilization)) |> Enum.sum()
+    if busy > 0, do: hashing / busy, else: 0.0
+  end
+
+  defp mean([], _fun), do: 0.0
+  defp mean(samples, fun), do: samples |> Enum.map(fun) |> Enum.sum() |> Kernel./(length(samples))
+
+  # The stats count calls that are waiting for a pool worker as in flight,
+  # so the number of busy workers is used when the pool is running.
+  defp running_hashes do
+    if Process.whereis(Comeonin.Pool) do
+      Comeonin.Pool.info().busy
+    else
+      Comeonin.Stats.in_flight()
+    end
+  end
+
+  defp utilization({active0, total0}, {active1, total1}) when total1 > total0 do
+    (active1 - active0) / (total1 - total0)
+  end
+
+  defp utilization(_, _), do: nil
+
+  defp schedule(config), do: Process.send_after(self(), :sample, config.interval)
+end
@@ -19,4 +19,55 @@ defmodule Comeonin.PasswordHash do
   password, and the second argument should be the password hash.
   """
   @callback verify_pass(password, password_hash) :: boolean
+
+  @doc """
+  Returns the options that `hash_pwd_salt/2` uses for a cost profile.
+
+  When `config :comeonin, cost_profile: :test` is set, `cost_opts(:test)`
+  should return the lowest-cost options that the implementation accepts.
+  See `Comeonin.CostProfile` for details.
+  """
+  @callback cost_opts(profile :: atom) :: opts
+
+  @typedoc """
+  Counters kept by the native code of an implementation, since it was
+  loaded. Every key is optional.
+
+    * `:calls` - the number of hashes and verifications
+    * `:kdf_us` - the time spent computing the KDF, in microseconds
+    * `:marshal_us` - the time spent converting the arguments and the
+      results between Erlang terms and native values, in microseconds
+    * `:alloc_bytes` - the bytes allocated for the KDF state
+    * `:arena_reuses` - the allocations served by reusing an arena
+    * `:arena_allocs` - the allocations that needed a new arena
+  """
+  @type native_stats :: %{
+          optional(:calls) => non_neg_integer,
+          optional(:kdf_us) => non_neg_integer,
+          optional(:marshal_us) => non_neg_integer,
+          optional(:alloc_bytes) => non_neg_integer,
+          optional(:arena_reuses) => non_neg_integer,
+          optional(:arena_allocs) => non_neg_integer
+        }
+
+  @doc """
+  Returns the counters kept by the native code of the implementation.
+
+  `Comeonin.Stats` folds these into its report, to show whether the time
+  of a hash is spent in the algorithm, in the allocator or at the NIF
+  boundary. The counters should be cheap to read, for example atomics
+  that are updated by the NIFs.
+  """
+  @callback native_stats() :: native_stats
+
+  @doc """
+  Releases memory that the implementation keeps for reuse, such as the
+  arenas of its native code.
+
+  This is called by `Comeonin.Pool` after it has been idle for its
+  `:idle_timeout`.
+  """
+  @callback trim_memory() :: :ok
+
+  @optional_callbacks cost_opts: 1, native_stats: 0, trim_memory: 0
 end
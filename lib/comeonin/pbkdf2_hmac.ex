@@ -0,0 +1,103 @@
+# :crypto.pbkdf2_hmac/5 was added in OTP 24.2, so the module is not defined
+# on older releases, rather than having hash functions that always raise.
+if Code.ensure_loaded?(:crypto) and function_exported?(:crypto, :pbkdf2_hmac, 5) do
+  defmodule Comeonin.Pbkdf2Hmac do
+    @moduledoc """
+    A Pbkdf2 implementation built on `:crypto.pbkdf2_hmac/5`.
+
+    The whole iteration loop runs in OpenSSL, so this is much faster than
+    computing the HMAC rounds in Erlang, and it needs no dependencies.
+    `:crypto.pbkdf2_hmac/5` was added in OTP 24.2, and this module is only
+    defined on that release or later - check with
+    `Code.ensure_loaded?(Comeonin.Pbkdf2Hmac)`. When it is defined, this is
+    the baseline that `mix comeonin.bench` compares other implementations
+    against.
+
+    The hashes are in the modular crypt format used by passlib and
+    pbkdf2_elixir - `$pbkdf2-sha512$rounds$salt$checksum`, with the salt
+    and the checksum in adapted base64 (standard base64, with `.` instead
+    of `+`, and no padding) - so hashes can be verified by either library.
+
+        iex> hash = Comeonin.Pbkdf2Hmac.hash_pwd_salt("password", rounds: 1000)
+        iex> Comeonin.Pbkdf2Hmac.verify_pass("password", hash)
+        true
+
+    """
+
+    use Comeonin
+
+    @default_rounds 160_000
+    @default_salt_len 16
+    @digests %{"sha512" => {:sha512, 64}, "sha256" => {:sha256, 32}}
+
+    @doc """
+    Generates a random salt and then hashes the password.
+
+    ## Options
+
+      * `:rounds` - the number of iterations
+        * the default is 160_000
+      * `:digest` - `:sha512` or `:sha256`
+        * the default is `:sha512`
+      * `:salt_len` - the length of the random salt, in bytes
+        * the default is 16
+      * `:length` - the length of the derived key, in bytes
+        * the default is the size of the digest (64 for sha512)
+    """
+    @impl true
+    def hash_pwd_salt(password, opts \\ []) do
+      digest = opts |> Keyword.get(:digest, :sha512) |> to_string()
+
+      {alg, default_length} =
+        Map.get(@digests, digest) || raise ArgumentError, "unsupported digest: #{digest}"
+
+      rounds = Keyword.get(opts, :rounds, @default_rounds)
+      salt = :crypto.strong_rand_bytes(Keyword.get(opts, :salt_len, @default_salt_len))
+      checksum = derive(alg, password, salt, rounds, Keyword.get(opts, :length, default_length))
+
+      Enum.join(["", "pbkdf2-" <> digest, rounds, encode64(salt), encode64(checksum)], "$")
+    end
+
+    @doc """
+    Checks the password by comparing its hash with the stored hash.
+
+    Returns false if the stored hash is not a Pbkdf2 hash in the modular
+    crypt format.
+    """
+    @impl true
+    def verify_pass(password, stored_hash)
+
+    def verify_pass(password, stored_hash) when is_binary(password) and is_binary(stored_hash) do
+      with ["", "pbkdf2-" <> digest, rounds, salt, checksum] <- String.split(stored_hash, "$"),
+           {:ok, {alg, _}} <- Map.fetch(@digests, digest),
+           {rounds, ""} when rounds > 0 <- Integer.parse(rounds),
+           {:ok, salt} <- decode64(salt),
+           {:ok, checksum} <- decode64(checksum),
+           true <- byte_size(checksum) > 0 do
+        alg
+        |> derive(password, salt, rounds, byte_size(checksum))
+        |> Comeonin.SecureCompare.equal?(checksum)
+      else
+        _ -> false
+      end
+    end
+
+    def verify_pass(_password, _stored_hash), do: false
+
+    @impl true
+    def cost_opts(:test), do: [rounds: 1]
+    def cost_opts(_profile), do: []
+
+    defp derive(alg, password, salt, rounds, length) do
+      :crypto.pbkdf2_hmac(alg, password, salt, rounds, length)
+    end
+
+    defp encode64(binary) do
+      binary |> Base.encode64(padding: false) |> String.replace("+", ".")
+    end
+
+    defp decode64(string) do
+      string |> String.replace(".", "+") |> Base.decode64(padding: false)
+    end
+  end
+end
@@ -0,0 +1,391 @@
+defmodule Comeonin.Pool do
+  @moduledoc """
+  A pool of hashing workers, sized from the container limits.
+
+  The pool is optional. It is started by the `:comeonin` application when
+  the `:pool` config is set:
+
+      config :comeonin, :pool,
+        per_hash_memory: 64 * 1024 * 1024,
+        memory_fraction: 0.5
+
+  While it is running, the `add_hash/2` and `check_pass/3` functions of
+  every `use Comeonin` module run the hash in one of its workers, so that
+  no more hashes run at the same time than the CPU quota and memory limit
+  of the container allow. Only the hash itself runs in the worker - the
+  user struct stays in the calling process. Calls that arrive when every
+  worker is busy wait in a queue.
+
+  The number of workers is `Comeonin.Limits.derive/2` of the current
+  limits (see that function for the options). The limits are read again
+  every `:refresh_interval` milliseconds (the default is 60_000), and the
+  pool grows or shrinks if they have changed.
+
+  ## Priorities
+
+  Calls can be given a priority, with the `:priority` option of the
+  helper functions (for example, `check_pass(user, password, priority:
+  :high)`), or of `run/2`. A free worker always takes the oldest call of
+  the highest priority that is waiting, so interactive logins can be
+  `:high` and bulk imports `:low`. The default is `:normal`.
+
+  ## Overload
+
+  Waiting calls are dropped from the queue if the calling process exits,
+  so that no hash is run for a request that has gone away. The queue can
+  also be bounded:
+
+    * `:max_queue` - the number of calls that can wait (the default is
+      `:infinity`) - `run/2` returns `{:error, :overloaded}` straight away
+      when the queue is full
+    * the `:timeout` option of `run/2` - the time, in milliseconds, that a
+      call can wait in the queue before `run/2` returns
+      `{:error, :overloaded}` (the default is `:infinity`)
+
+  `check_pass/3` returns `{:error, "hashing is overloaded"}` for these
+  calls, and `add_hash/2` raises.
+
+  ## Idle trimming
+
+  After a burst, the workers, and the native arenas of the
+  implementations, can hold a lot of memory that is not used again for
+  hours. Workers that have been idle for `:hibernate_after` milliseconds
+  (the default is 5_000) hibernate, which releases their heaps. When the
+  pool has been idle for `:idle_timeout` milliseconds (the default is
+  `:infinity`), it stops all but `:min_workers` workers (the default is
+  1), and calls the optional `trim_memory/0` callback of each
+  implementation that has run in the pool, and of each module in the
+  `:modules` option, so that it can release its arenas. The pool grows
+  back, up to its size, when calls arrive.
+  """
+
+  use GenServer
+
+  require Logger
+
+  @worker_key {__MODULE__, :worker}
+  @priorities [:high, :normal, :low]
+
+  @doc false
+  def start_link(opts) do
+    GenServer.start_link(__MODULE__, opts, name: __MODULE__)
+  end
+
+  @doc """
+  Runs `fun` in a pool worker, and returns its result, or
+  `{:error, :overloaded}` if the queue is full or the call waited longer
+  than its `:timeout`.
+
+  If the pool is not running, or this is called from a pool worker, `fun`
+  is run in the calling process.
+
+  ## Options
+
+    * `:priority` - `:high`, `:normal` or `:low`
+      * the default is `:normal`
+    * `:timeout` - the time, in milliseconds, that the call can wait in the
+      queue - it does not limit the time taken by `fun`
+      * the default is `:infinity`
+    * `:module` - the implementation that `fun` runs, whose
+      `trim_memory/0` callback is called when the pool is trimmed
+  """
+  @spec run((() -> result), keyword) :: result | {:error, :overloaded} when result: term
+  def run(fun, opts \\ []) do
+    pool = Process.whereis(__MODULE__)
+
+    if is_nil(pool) or Process.get(@worker_key) do
+      fun.()
+    else
+      call = {:run, fun, priority(opts), Keyword.get(opts, :timeout, :infinity), opts[:module]}
+
+      case GenServer.call(pool, call, :infinity) do
+        {:ok, result} -> result
+        {:error, :overloaded} -> {:error, :overloaded}
+        {:raise, kind, reason, stacktrace} -> :erlang.raise(kind, reason, stacktrace)
+      end
+    end
+  end
+
+  defp priority(opts) do
+    case Keyword.get(opts, :priority) do
+      nil -> :normal
+      priority when priority in @priorities -> priority
+      other -> raise ArgumentError, "invalid priority #{inspect(other)}"
+    end
+  end
+
+  @doc """
+  Returns the size of the pool, the number of busy workers, the length of
+  the queue (in total and for each priority) and the limits that the size
+  was derived from.
+  """
+  @spec info() :: map
+  def info do
+    GenServer.call(__MODULE__, :info)
+  end
+
+  @doc false
+  @spec workers() :: [pid]
+  def workers do
+    GenServer.call(__MODULE__, :workers)
+  end
+
+  @impl true
+  def init(opts) do
+    Process.flag(:trap_exit, true)
+    limits = Comeonin.Limits.derive(Comeonin.Limits.read(), opts)
+    queues = Map.new(@priorities, &{&1, :queue.new()})
+    state = %{
+      opts: opts,
+      limits: limits,
+      idle: [],
+      busy: %{},
+      queues: queues,
+      size: limits.concurrency,
+      last_active: now(),
+      trimmed: false,
+      modules: MapSet.new(Keyword.get(opts, :modules, []))
+    }
+
+    schedule_refresh(opts)
+    schedule_idle_check(opts)
+    {:ok, start_workers(state, limits.concurrency)}
+  end
+
+  @impl true
+  def handle_call({:run, fun, priority, timeout, module}, {pid, _} = from, state) do
+    modules = if module, do: MapSet.put(state.modules, module), else: state.modules
+    state = %{state | last_active: now(), trimmed: false, modules: modules}
+
+    if overloaded?(state) do
+      {:reply, {:error, :overloaded}, state}
+    else
+      ref = Process.monitor(pid)
+      timer = if timeout != :infinity, do: Process.send_after(self(), {:expire, ref}, timeout)
+      queues = Map.update!(state.queues, priority, &:queue.in({from, fun, ref, timer}, &1))
+      {:noreply, dispatch(%{state | queues: queues})}
+    end
+  end
+
+  def handle_call(:info, _from, state) do
+    by_priority = Map.new(state.queues, fn {priority, queue} -> {priority, :queue.len(queue)} end)
+
+    info = %{
+      size: state.size,
+      workers: map_size(state.busy) + length(state.idle),
+      busy: map_size(state.busy),
+      queued: by_priority |> Map.values() |> Enum.sum(),
+      queued_by_priority: by_priority,
+      limits: state.limits
+    }
+
+    {:reply, info, state}
+  end
+
+  def handle_call(:workers, _from, state) do
+    {:reply, Map.keys(state.busy) ++ state.idle, state}
+  end
+
+  @impl true
+  def handle_info({:DOWN, ref, :process, _pid, _reason}, state) do
+    {_job, queues} = take(state.queues, ref)
+    {:noreply, %{state | queues: queues}}
+  end
+
+  def handle_info({:expire, ref}, state) do
+    case take(state.queues, ref) do
+      {nil, _queues} ->
+        {:noreply, state}
+
+      {{from, _fun, ref, _timer}, queues} ->
+        Process.demonitor(ref, [:flush])
+        GenServer.reply(from, {:error, :overloaded})
+        {:noreply, %{state | queues: queues}}
+    end
+  end
+
+  def handle_info({:done, worker}, state) do
+    state = %{state | busy: Map.delete(state.busy, worker)}
+
+    if map_size(state.busy) + length(state.idle) >= state.size do
+      send(worker, :stop)
+      {:noreply, state}
+    else
+      {:noreply, dispatch(%{state | idle: [worker | state.idle]})}
+    end
+  end
+
+  def handle_info(:refresh, state) do
+    limits = Comeonin.Limits.derive(Comeonin.Limits.read(), state.opts)
+    schedule_refresh(state.opts)
+
+    if limits.concurrency != state.size do
+      Logger.info("Comeonin.Pool resized from #{state.size} to #{limits.concurrency} workers")
+    end
+
+    {:noreply, dispatch(resize(%{state | limits: limits}, limits.concurrency))}
+  end
+
+  def handle_info(:idle_check, state) do
+    schedule_idle_check(state.opts)
+    timeout = Keyword.get(state.opts, :idle_timeout, :infinity)
+
+    if not state.trimmed and map_size(state.busy) == 0 and now() - state.last_active >= timeout do
+      {:noreply, trim(state)}
+    else
+      {:noreply, state}
+    end
+  end
+
+  def handle_info({:EXIT, worker, reason}, state) do
+    case Map.pop(state.busy, worker) do
+      {nil, _} ->
+        {:noreply, dispatch(%{state | idle: List.delete(state.idle, worker)})}
+
+      {from, busy} ->
+        GenServer.reply(from, {:raise, :exit, reason, []})
+        {:noreply, dispatch(%{state | busy: busy})}
+    end
+  end
+
+  # Workers are started when calls are waiting and there are fewer workers
+  # than the size of the pool, which is the case after a trim, or after a
+  # worker has crashed.
+  defp dispatch(state), do: state |> grow() |> assign()
+
+  defp grow(%{idle: []} = state) do
+    start_workers(state, min(queued(state), state.size - map_size(state.busy)))
+  end
+
+  defp grow(state), do: state
+
+  defp assign(%{idle: [worker | idle]} = state) do
+    case next(state.queues, @priorities) do
+      {{from, fun, ref, timer}, queues} ->
+        Process.demonitor(ref, [:flush])
+        if timer, do: Process.cancel_timer(timer)
+        send(worker, {:run, from, fun})
+        assign(%{state | idle: idle, queues: queues, busy: Map.put(state.busy, worker, from)})
+
+      nil ->
+        state
+    end
+  end
+
+  defp assign(state), do: state
+
+  defp next(_queues, []), do: nil
+
+  defp next(queues, [priority | rest]) do
+    case :queue.out(Map.fetch!(queues, priority)) do
+      {{:value, call}, queue} -> {call, %{queues | priority => queue}}
+      {:empty, _} -> next(queues, rest)
+    end
+  end
+
+  # Removes the waiting call with the monitor `ref`, if it is still queued.
+  defp take(queues, ref) do
+    Enum.reduce(queues, {nil, queues}, fn {priority, queue}, {found, acc} ->
+      {taken, kept} = queue |> :queue.to_list() |> Enum.split_with(&(elem(&1, 2) == ref))
+
+      case taken do
+        [] -> {found, acc}
+        [job] -> {job, %{acc | priority => :queue.from_list(kept)}}
+      end
+    end)
+  end
+
+  defp overloaded?(state) do
+    case Keyword.get(state.opts, :max_queue, :infinity) do
+      :infinity ->
+        false
+
+      max_queue ->
+        state.idle == [] and map_size(state.busy) >= state.size and queued(state) >= max_queue
+    end
+  end
+
+  defp queued(state) do
+    state.queues |> Map.values() |> Enum.map(&:queue.len/1) |> Enum.sum()
+  end
+
+  # Busy workers are never stopped - they stop when they finish, if the
+  # pool is still too big. A bigger pool grows when calls arrive.
+  defp resize(state, size) do
+    stop_idle(%{state | size: size}, map_size(state.busy) + length(state.idle) - size)
+  end
+
+  defp stop_idle(state, count) when count > 0 do
+    {stop, keep} = Enum.split(state.idle, min(count, length(state.idle)))
+    Enum.each(stop, &send(&1, :stop))
+    %{state | idle: keep}
+  end
+
+  defp stop_idle(state, _count), do: state
+
+  defp trim(state) do
+    min_workers = Keyword.get(state.opts, :min_workers, 1)
+    before = length(state.idle)
+    state = stop_idle(state, before - min_workers)
+
+    state.modules
+    |> Enum.filter(&(Code.ensure_loaded?(&1) and function_exported?(&1, :trim_memory, 0)))
+    |> Enum.each(& &1.trim_memory())
+
+    :erlang.garbage_collect()
+    Logger.info("Comeonin.Pool trimmed from #{before} to #{length(state.idle)} idle workers")
+    %{state | trimmed: true}
+  end
+
+  defp start_workers(state, count) when count > 0 do
+    new = for _ <- 1..count, do: start_worker(state.opts)
+    %{state | idle: new ++ state.idle}
+  end
+
+  defp start_workers(state, _count), do: state
+
+  defp start_worker(opts) do
+    pool = self()
+    hibernate_after = Keyword.get(opts, :hibernate_after, 5_000)
+
+    spawn_link(fn ->
+      Process.put(@worker_key, true)
+      worker_loop(pool, hibernate_after)
+    end)
+  end
+
+  @doc false
+  def worker_loop(pool, hibernate_after) do
+    receive do
+      {:run, from, fun} ->
+        GenServer.reply(from, execute(fun))
+        send(pool, {:done, self()})
+        worker_loop(pool, hibernate_after)
+
+      :stop ->
+        :ok
+    after
+      hibernate_after ->
+        :erlang.hibernate(__MODULE__, :worker_loop, [pool, hibernate_after])
+    end
+  end
+
+  defp execute(fun) do
+    {:ok, fun.()}
+  catch
+    kind, reason -> {:raise, kind, reason, __STACKTRACE__}
+  end
+
+  defp schedule_refresh(opts) do
+    Process.send_after(self(), :refresh, Keyword.get(opts, :refresh_interval, 60_000))
+  end
+
+  defp schedule_idle_check(opts) do
+    case Keyword.get(opts, :idle_timeout, :infinity) do
+      :infinity -> :ok
+      timeout -> Process.send_after(self(), :idle_check, max(div(timeout, 4), 10))
+    end
+  end
+
+  defp now, do: System.monotonic_time(:millisecond)
+end
@@ -0,0 +1,256 @@
+defmodule Comeonin.Profile do
+  @moduledoc """
+  Profiles the helper functions of a `Comeonin.PasswordHash` implementation.
+
+  The Erlang side is profiled with `call_time` tracing, which is the
+  mechanism that `:eprof` and `:tprof` are built on. The time spent in
+  each function, excluding the functions it calls, is assigned to one of
+  these categories:
+
+    * `wrapper` - the helper functions of Comeonin, its stats, recorder,
+      pool, auto-tuner and cost profile, and the standard library functions
+      they call, such as `Keyword` and `Map`
+    * `salt` - salt generation, that is, `:crypto.strong_rand_bytes/1` and
+      functions in the implementation with `salt` in their name (other
+      than `hash_pwd_salt`)
+    * `kdf` - everything else, including the NIFs of the implementation
+
+  When Linux `perf` is available, the native code can be sampled as well
+  (see `perf/2`).
+
+  The results are written as folded stacks (`frame;frame;frame count`),
+  which can be turned into a flame graph with `flamegraph.pl` or speedscope.
+  See `mix comeonin.profile` for a command line interface.
+  """
+
+  @password "correct horse battery staple"
+  @stdlib_modules [Access, Enum, Kernel, Keyword, Map, :lists, :maps, :erlang]
+  @runtime_modules [
+    GenServer,
+    Process,
+    System,
+    :counters,
+    :ets,
+    :gen,
+    :gen_server,
+    :persistent_term,
+    :proc_lib,
+    :queue
+  ]
+  @comeonin_modules [
+    Comeonin,
+    Comeonin.AutoTuner,
+    Comeonin.CostProfile,
+    Comeonin.Limits,
+    Comeonin.Pool,
+    Comeonin.Recorder,
+    Comeonin.Stats,
+    Comeonin.Ticket
+  ]
+  @wrapper_modules @stdlib_modules ++ @runtime_modules ++ @comeonin_modules
+
+  @doc """
+  Returns the workload that is profiled - `runs` calls to `add_hash/2`
+  and `runs` calls to `check_pass/3`.
+  """
+  @spec workload(module, keyword, pos_integer) :: (() -> :ok)
+  def workload(module, hash_opts, runs) do
+    user = %{id: 1, password_hash: module.hash_pwd_salt(@password, hash_opts)}
+
+    fn ->
+      for _ <- 1..runs do
+        module.add_hash(@password, hash_opts)
+        module.check_pass(user, @password, hash_opts)
+      end
+
+      :ok
+    end
+  end
+
+  @doc """
+  Runs `fun` in a new process with `call_time` tracing, and returns the
+  time, in microseconds, spent in each function.
+
+  If `Comeonin.Pool` is running, the pool and its workers, where the
+  hashes run, are traced as well.
+  """
+  @spec call_times((() -> term)) :: [{mfa, non_neg_integer}]
+  def call_times(fun) do
+    parent = self()
+
+    pid =
+      spawn_link(fn ->
+        receive do
+          :go -> fun.()
+        end
+
+        send(parent, {:profiled, self()})
+      end)
+
+    :erlang.trace_pattern({:_, :_, :_}, true, [:call_time])
+    :erlang.trace_pattern(:on_load, true, [:call_time])
+    :erlang.trace(pid, true, [:call, :set_on_spawn])
+    Enum.each(pool_pids(), &trace(&1, true))
+    send(pid, :go)
+
+    receive do
+      {:profiled, ^pid} -> :ok
+    end
+
+    Enum.each(pool_pids(), &trace(&1, false))
+    times = collect_call_times()
+    :erlang.trace_pattern({:_, :_, :_}, false, [:call_time])
+    :erlang.trace_pattern(:on_load, false, [:call_time])
+    times
+  end
+
+  # The workers that the pool starts while it is traced inherit the trace
+  # flags from the pool.
+  defp pool_pids do
+    case Process.whereis(Comeonin.Pool) do
+      nil -> []
+      pool -> [pool | Comeonin.Pool.workers()]
+    end
+  end
+
+  # A worker can stop between being listed and being traced.
+  defp trace(pid, on) do
+    :erlang.trace(pid, on, [:call, :set_on_spawn])
+  rescue
+    ArgumentError -> 0
+  end
+
+  defp collect_call_times do
+    for {mod, _} <- :code.all_loaded(),
+        {fun, arity} <- mod.module_info(:functions),
+        {:call_time, [_ | _] = calls} <- [:erlang.trace_info({mod, fun, arity}, :call_time)],
+        time <- [Enum.reduce(calls, 0, fn {_, _, s, us}, acc -> acc + s * 1_000_000 + us end)],
+        time > 0 do
+      {{mod, fun, arity}, time}
+    end
+  end
+
+  @doc """
+  Returns the category of a function for an implementation.
+  """
+  @spec category(mfa, module) :: :wrapper | :salt | :kdf
+  def category({:crypto, :strong_rand_bytes, _}, _module), do: :salt
+
+  def category({mod, fun, _}, module) do
+    name = Atom.to_string(mod)
+
+    cond do
+      mod in @wrapper_modules -> :wrapper
+      fun in [:add_hash, :check_pass, :get_hash, :instrument] and mod == module -> :wrapper
+      fun != :hash_pwd_salt and implementation?(name, module) and salt?(fun) -> :salt
+      true -> :kdf
+    end
+  end
+
+  defp implementation?(name, module) do
+    String.starts_with?(name, Atom.to_string(module))
+  end
+
+  defp salt?(fun), do: fun |> Atom.to_string() |> String.contains?("salt")
+
+  @doc """
+  Converts call times into folded stacks.
+  """
+  @spec fold([{mfa, non_neg_integer}], module) :: [binary]
+  def fold(times, module) do
+    for {{mod, fun, arity} = mfa, time} <- Enum.sort_by(times, &(-elem(&1, 1))) do
+      "erlang;#{category(mfa, module)};#{inspect(mod)}.#{fun}/#{arity} #{time}"
+    end
+  end
+
+  @doc """
+  Sums the call times for each category.
+  """
+  @spec totals([{mfa, non_neg_integer}], module) :: %{atom => non_neg_integer}
+  def totals(times, module) do
+    Enum.reduce(times, %{wrapper: 0, salt: 0, kdf: 0}, fn {mfa, time}, acc ->
+      Map.update!(acc, category(mfa, module), &(&1 + time))
+    end)
+  end
+
+  @doc """
+  Samples this VM with Linux `perf` while `fun` runs, and returns the
+  native stacks as folded stacks.
+
+  Returns `{:error, reason}` if `perf` is not installed or fails. Frames
+  for Erlang code are only named if the VM is started with `+JPperf true`.
+  """
+  @spec perf((() -> term), keyword) :: {:ok, [binary]} | {:error, String.t()}
+  def perf(fun, opts \\ []) do
+    frequency = Keyword.get(opts, :frequency, 999)
+
+    case System.find_executable("perf") do
+      nil ->
+        {:error, "perf is not installed"}
+
+      perf ->
+        name = "comeonin_perf_#{System.unique_integer([:positive])}.data"
+        data = Path.join(System.tmp_dir!(), name)
+        pid = List.to_string(:os.getpid())
+        args = ["record", "-F", "#{frequency}", "-g", "-p", pid, "-o", data]
+        port = Port.open({:spawn_executable, perf}, [:binary, :exit_status, args: args])
+        {:os_pid, os_pid} = Port.info(port, :os_pid)
+        # gives perf time to attach before the workload starts
+        Process.sleep(500)
+        fun.()
+        System.cmd("kill", ["-INT", "#{os_pid}"])
+        wait_for_exit(port)
+
+        result =
+          case System.cmd(perf, ["script", "-i", data], stderr_to_stdout: true) do
+            {script, 0} -> {:ok, fold_perf_script(script)}
+            {output, _} -> {:error, "perf script failed: #{output}"}
+          end
+
+        File.rm(data)
+        result
+    end
+  end
+
+  defp wait_for_exit(port) do
+    receive do
+      {^port, {:exit_status, _}} -> :ok
+      {^port, {:data, _}} -> wait_for_exit(port)
+    end
+  end
+
+  @doc """
+  Folds the output of `perf script` into folded stacks.
+  """
+  @spec fold_perf_script(binary) :: [binary]
+  def fold_perf_script(script) do
+    script
+    |> String.split(~r/\n\s*\n/, trim: true)
+    |> Enum.map(&perf_stack/1)
+    |> Enum.reject(&(&1 == []))
+    |> Enum.reduce(%{}, fn frames, acc ->
+      Map.update(acc, Enum.join(["native" | frames], ";"), 1, &(&1 + 1))
+    end)
+    |> Enum.map(fn {stack, count} -> "#{stack} #{count}" end)
+  end
+
+  defp perf_stack(sample) do
+    [_header | frames] = String.split(sample, "\n", trim: true)
+
+    frames
+    |> Enum.map(&perf_frame/1)
+    |> Enum.reverse()
+  end
+
+  defp perf_frame(frame) do
+    case String.split(String.trim(frame), " ", parts: 2) do
+      [_address, symbol] ->
+        symbol
+        |> String.replace(~r/\s+\(.*\)$/, "")
+        |> String.replace(";", ":")
+
+      [address] ->
+        address
+    end
+  end
+end
@@ -0,0 +1,196 @@
+defmodule Comeonin.Recorder do
+  @moduledoc """
+  Records the arrival of `add_hash/2` and `check_pass/3` calls to a file,
+  so that production traffic can be replayed against other configurations.
+
+  The recorder is opt-in. Add it to your supervision tree:
+
+      children = [
+        {Comeonin.Recorder, path: "/var/log/myapp/logins.trace"}
+      ]
+
+  While it is running, every call to the `add_hash/2` and `check_pass/3`
+  functions of a `use Comeonin` module writes one record containing the
+  time of the call, its duration, the operation, the outcome and the
+  hash parameters (see `Comeonin.HashInfo`). User data, passwords, salts
+  and checksums are never recorded. When the recorder is not running,
+  the cost to each call is one `:persistent_term` lookup.
+
+  Traces can be replayed with `replay/3`, or with the `--trace` option of
+  `mix comeonin.loadtest`.
+
+  ## File format
+
+  The file starts with the 8-byte magic `"CMNTRC1\\n"`, followed by
+  records of the form:
+
+      <<timestamp_us::64, duration_us::32, operation::8, outcome::8,
+        prefix_size::8, prefix::binary-size(prefix_size)>>
+
+  """
+
+  use GenServer
+
+  @key {__MODULE__, :pid}
+  @magic "CMNTRC1\n"
+  @max_duration 0xFFFFFFFF
+
+  @operations [add_hash: 1, check_pass: 2]
+  @outcomes [ok: 1, invalid_password: 2, no_user: 3, no_hash: 4, invalid_input: 5, overloaded: 6]
+
+  @type operation :: :add_hash | :check_pass
+  @type outcome ::
+          :ok | :invalid_password | :no_user | :no_hash | :invalid_input | :overloaded
+  @type record :: %{
+          timestamp: integer,
+          duration: non_neg_integer,
+          operation: operation,
+          outcome: outcome,
+          prefix: binary
+        }
+
+  @doc """
+  Starts the recorder.
+
+  ## Options
+
+    * `:path` - the file that the trace is appended to (required)
+  """
+  def start_link(opts) do
+    GenServer.start_link(__MODULE__, Keyword.fetch!(opts, :path), name: __MODULE__)
+  end
+
+  @doc """
+  Returns the start time of an operation, or nil if the recorder is not running.
+  """
+  @spec start_time() :: integer | nil
+  def start_time do
+    if :persistent_term.get(@key, nil), do: System.monotonic_time(:microsecond)
+  end
+
+  @doc """
+  Records an operation that started at `started`.
+
+  This does nothing if `started` is nil.
+  """
+  @spec record(operation, outcome, binary | nil, integer | nil) :: :ok
+  def record(_operation, _outcome, _hash, nil), do: :ok
+
+  def record(operation, outcome, hash, started) do
+    duration = System.monotonic_time(:microsecond) - started
+
+    case :persistent_term.get(@key, nil) do
+      nil -> :ok
+      pid -> GenServer.cast(pid, {:record, encode(operation, outcome, hash, duration)})
+    end
+  end
+
+  @doc """
+  Reads the records in a trace file.
+  """
+  @spec read(Path.t()) :: [record]
+  def read(path) do
+    case File.read!(path) do
+      @magic <> records -> decode(records, [])
+      _ -> raise ArgumentError, "#{path} is not a Comeonin trace file"
+    end
+  end
+
+  @doc """
+  Replays a trace against `module`, using `Comeonin.LoadTest`.
+
+  The arrivals keep the spacing of the original trace. Records for calls
+  that were made with invalid input are skipped.
+
+  ## Options
+
+    * `:speed` - how much faster than real time the trace is replayed
+      * the default is 1.0
+
+  The other options are passed on to `Comeonin.LoadTest.run/2`.
+  """
+  @spec replay(Path.t(), module, keyword) :: map
+  def replay(path, module, opts \\ []) do
+    {speed, opts} = Keyword.pop(opts, :speed, 1.0)
+    Comeonin.LoadTest.run(module, Keyword.put(opts, :arrivals, arrivals(read(path), speed)))
+  end
+
+  @doc false
+  def arrivals([], _speed), do: []
+
+  def arrivals([%{timestamp: first} | _] = records, speed) do
+    Enum.flat_map(records, fn record ->
+      case kind(record) do
+        nil -> []
+        kind -> [{round((record.timestamp - first) / speed), kind}]
+      end
+    end)
+  end
+
+  defp kind(%{operation: :add_hash}), do: :add_hash
+  defp kind(%{outcome: :ok}), do: :valid
+  defp kind(%{outcome: :invalid_password}), do: :wrong_password
+  defp kind(%{outcome: :no_user}), do: :nil_user
+  defp kind(%{outcome: :no_hash}), do: :missing_hash
+  defp kind(_), do: nil
+
+  @impl true
+  def init(path) do
+    Process.flag(:trap_exit, true)
+    File.mkdir_p!(Path.dirname(path))
+    {:ok, file} = :file.open(path, [:append, :raw, :binary, {:delayed_write, 65_536, 1000}])
+    if File.stat!(path).size == 0, do: :ok = :file.write(file, @magic)
+    :persistent_term.put(@key, self())
+    {:ok, file}
+  end
+
+  @impl true
+  def handle_cast({:record, record}, file) do
+    :ok = :file.write(file, record)
+    {:noreply, file}
+  end
+
+  @impl true
+  def terminate(_reason, file) do
+    :persistent_term.erase(@key)
+    :file.close(file)
+  end
+
+  @doc false
+  def encode(operation, outcome, hash, duration) do
+    timestamp = System.os_time(:microsecond) - duration
+    prefix = (hash && Comeonin.HashInfo.prefix(hash)) || ""
+    prefix = binary_part(prefix, 0, min(byte_size(prefix), 255))
+    duration = min(duration, @max_duration)
+    operation = Keyword.fetch!(@operations, operation)
+    outcome = Keyword.fetch!(@outcomes, outcome)
+
+    <<timestamp::64, duration::32, operation::8, outcome::8, byte_size(prefix)::8,
+      prefix::binary>>
+  end
+
+  defp decode(<<>>, acc), do: Enum.reverse(acc)
+
+  defp decode(
+         <<timestamp::64, duration::32, operation::8, outcome::8, size::8,
+           prefix::binary-size(size), rest::binary>>,
+         acc
+       ) do
+    record = %{
+      timestamp: timestamp,
+      duration: duration,
+      operation: from_code(@operations, operation),
+      outcome: from_code(@outcomes, outcome),
+      prefix: prefix
+    }
+
+    decode(rest, [record | acc])
+  end
+
+  # A partial record at the end of the file is left by a crash, and is ignored.
+  defp decode(_, acc), do: Enum.reverse(acc)
+
+  defp from_code(codes, code) do
+    Enum.find_value(codes, fn {name, value} -> if value == code, do: name end)
+  end
+end
@@ -0,0 +1,50 @@
+defmodule Comeonin.SecureCompare do
+  @moduledoc """
+  Compares binaries in constant time, for checking hashes and MACs.
+
+  `equal?/2` is meant to be shared by every `Comeonin.PasswordHash`
+  implementation, instead of each one rolling its own comparison.
+
+  The binaries are compared 7 bytes at a time, and the differences are
+  accumulated with XOR and OR, so the time taken depends only on the
+  length of the binaries, not on where, or if, they differ. Seven bytes
+  is the largest word that is always a small integer on a 64-bit VM - a
+  wider word would sometimes become a bignum, and bignum arithmetic does
+  not take constant time.
+  """
+
+  import Bitwise
+
+  @doc """
+  Checks if two binaries are equal, in constant time.
+
+  Binaries of different lengths are never equal, and this is returned
+  straight away - the length of a hash or MAC is not secret.
+
+  ## Examples
+
+      iex> Comeonin.SecureCompare.equal?("hash", "hash")
+      true
+
+      iex> Comeonin.SecureCompare.equal?("hash", "hasp")
+      false
+
+  """
+  @spec equal?(binary, binary) :: boolean
+  def equal?(left, right)
+      when is_binary(left) and is_binary(right) and byte_size(left) == byte_size(right) do
+    compare(left, right, 0) == 0
+  end
+
+  def equal?(left, right) when is_binary(left) and is_binary(right), do: false
+
+  defp compare(<<x::56, left::binary>>, <<y::56, right::binary>>, acc) do
+    compare(left, right, acc ||| bxor(x, y))
+  end
+
+  defp compare(<<x, left::binary>>, <<y, right::binary>>, acc) do
+    compare(left, right, acc ||| bxor(x, y))
+  end
+
+  defp compare(<<>>, <<>>, acc), do: acc
+end
@@ -0,0 +1,225 @@
+defmodule Comeonin.Server do
+  @moduledoc """
+  Serves `hash_pwd_salt` and `verify_pass` over a Unix domain socket.
+
+  Services on the same host that are not written in Elixir or Erlang can
+  use this server instead of running their own KDF, so that all of the
+  hashing on the host goes through the same `Comeonin.Pool`, priorities
+  and `Comeonin.Stats`, and the host is not oversubscribed.
+
+  The server is optional. It is started by the `:comeonin` application
+  when the `:server` config is set:
+
+      config :comeonin, :server,
+        module: Argon2,
+        path: "/run/comeonin/comeonin.sock"
+
+  ## Options
+
+    * `:module` - the implementation (required)
+    * `:path` - the path of the socket (required)
+      * an existing socket at this path is replaced - the server does not
+        start if there is any other kind of file there
+    * `:mode` - the file permissions of the socket
+      * the default is `0o660`
+      * the socket is created in a private directory, and only moved to
+        `:path` once it has these permissions
+    * `:max_request_size` - the largest request, in bytes
+      * the default is 65_536
+      * a connection that sends a larger request is closed
+    * `:hash_opts` - the options passed to `add_hash/2` and `check_pass/3`
+      * the default is `[]`
+
+  ## Protocol
+
+  Each request and each response is a frame - a 32-bit big-endian length
+  followed by that many bytes. A connection can send any number of
+  requests, no larger than `:max_request_size`, and gets the responses in
+  the same order.
+
+  A request is an operation byte, a priority byte (0 for `:high`, 1 for
+  `:normal` and 2 for `:low`) and the payload:
+
+    * hash (operation 1) - the password
+    * verify (operation 2) - the 32-bit big-endian length of the password,
+      the password and the hash
+
+  A response is a status byte and the result. The status is 0 on success,
+  followed by the hash, or by 1 (match) or 0 (no match) for a verify. It
+  is 1 on error, followed by an error message.
+  """
+
+  use GenServer
+
+  require Logger
+
+  @hash 1
+  @verify 2
+  @max_request_size 65_536
+  @priorities %{0 => :high, 1 => :normal, 2 => :low}
+
+  @doc false
+  def start_link(opts) do
+    GenServer.start_link(__MODULE__, opts, name: __MODULE__)
+  end
+
+  @doc """
+  Handles one request, and returns the response.
+  """
+  @spec handle_request(binary, module, keyword) :: binary
+  def handle_request(<<op, priority, payload::binary>>, module, hash_opts)
+      when priority in 0..2 do
+    opts = [priority: Map.fetch!(@priorities, priority)] ++ hash_opts
+
+    case {op, payload} do
+      {@hash, password} ->
+        %{password_hash: hash} = module.add_hash(password, opts)
+        <<0, hash::binary>>
+
+      {@verify, <<size::32, password::binary-size(size), hash::binary>>} ->
+        user = %{password_hash: hash}
+
+        case module.check_pass(user, password, [hide_user: false] ++ opts) do
+          {:ok, _} -> <<0, 1>>
+          {:error, _} -> <<0, 0>>
+        end
+
+      _ ->
+        <<1, "invalid request">>
+    end
+  end
+
+  def handle_request(_request, _module, _hash_opts), do: <<1, "invalid request">>
+
+  @impl true
+  def init(opts) do
+    Process.flag(:trap_exit, true)
+    path = Keyword.fetch!(opts, :path)
+    hash_opts = opts |> Keyword.get(:hash_opts, []) |> Keyword.delete(:hash_key)
+    config = {Keyword.fetch!(opts, :module), hash_opts}
+    mode = Keyword.get(opts, :mode, 0o660)
+    packet_size = Keyword.get(opts, :max_request_size, @max_request_size)
+    listen_opts = [:binary, packet: 4, packet_size: packet_size, active: false]
+
+    case listen(path, mode, listen_opts) do
+      {:ok, listener} ->
+        {:ok, tasks} = Task.Supervisor.start_link()
+        acceptor = spawn_link(fn -> accept(listener, tasks, config) end)
+        {:ok, %{listener: listener, acceptor: acceptor, tasks: tasks, path: path}}
+
+      {:error, reason} ->
+        {:stop, {:listen, path, reason}}
+    end
+  end
+
+  @impl true
+  def handle_info({:EXIT, pid, reason}, %{acceptor: acceptor, tasks: tasks} = state)
+      when pid in [acceptor, tasks] do
+    {:stop, reason, state}
+  end
+
+  def handle_info(_message, state), do: {:noreply, state}
+
+  @impl true
+  def terminate(_reason, state) do
+    :gen_tcp.close(state.listener)
+    remove_socket(state.path)
+  end
+
+  # The socket is bound in a new directory that only this user can enter,
+  # and is moved to the path after its mode is set, so that no other user
+  # can connect to it in between.
+  defp listen(path, mode, listen_opts) do
+    name = ".comeonin_#{:os.getpid()}_#{System.unique_integer([:positive])}"
+    dir = Path.join(Path.dirname(path), name)
+    private_path = Path.join(dir, "socket")
+    listen_opts = [ifaddr: {:local, private_path}] ++ listen_opts
+
+    with :ok <- File.mkdir(dir) do
+      result =
+        with :ok <- File.chmod(dir, 0o700),
+             {:ok, listener} <- :gen_tcp.listen(0, listen_opts) do
+          publish(listener, private_path, path, mode)
+        end
+
+      File.rm_rf(dir)
+      result
+    end
+  end
+
+  defp publish(listener, private_path, path, mode) do
+    with :ok <- remove_socket(path),
+         :ok <- File.chmod(private_path, mode),
+         :ok <- File.rename(private_path, path) do
+      {:ok, listener}
+    else
+      error ->
+        :gen_tcp.close(listener)
+        error
+    end
+  end
+
+  # Only a socket, left by an earlier run, is removed - the server does not
+  # start if there is anything else at the path.
+  defp remove_socket(path) do
+    case File.lstat(path) do
+      {:ok, %File.Stat{type: :other}} -> File.rm(path)
+      {:ok, %File.Stat{}} -> {:error, {:not_a_socket, path}}
+      {:error, :enoent} -> :ok
+      error -> error
+    end
+  end
+
+  defp accept(listener, tasks, config) do
+    case :gen_tcp.accept(listener) do
+      {:ok, socket} ->
+        start_connection(tasks, socket, config)
+        accept(listener, tasks, config)
+
+      {:error, :closed} ->
+        :ok
+
+      {:error, reason} ->
+        Logger.error("Comeonin.Server could not accept a connection: #{inspect(reason)}")
+        accept(listener, tasks, config)
+    end
+  end
+
+  # The connection waits until it owns the socket before it reads from it.
+  defp start_connection(tasks, socket, config) do
+    {:ok, pid} =
+      Task.Supervisor.start_child(tasks, fn ->
+        receive do
+          {:socket, ^socket} -> serve(socket, config)
+        end
+      end)
+
+    case :gen_tcp.controlling_process(socket, pid) do
+      :ok ->
+        send(pid, {:socket, socket})
+
+      {:error, _} ->
+        Process.exit(pid, :kill)
+        :gen_tcp.close(socket)
+    end
+  end
+
+  defp serve(socket, {module, hash_opts} = config) do
+    case :gen_tcp.recv(socket, 0) do
+      {:ok, request} ->
+        :ok = :gen_tcp.send(socket, safe_handle_request(request, module, hash_opts))
+        serve(socket, config)
+
+      {:error, _} ->
+        :gen_tcp.close(socket)
+    end
+  end
+
+  defp safe_handle_request(request, module, hash_opts) do
+    handle_request(request, module, hash_opts)
+  catch
+    kind, reason ->
+      Logger.error("Comeonin.Server request failed: " <> Exception.format_banner(kind, reason))
+      <<1, "internal error">>
+  end
+end
@@ -0,0 +1,362 @@
+defmodule Comeonin.Stats do
+  @moduledoc """
+  Always-on statistics for the helper functions of `use Comeonin` modules.
+
+  For each module and operation (`add_hash`, `check_pass`), a `:counters`
+  array holds the number of calls, the number of calls that did not
+  succeed, the number of calls in flight, the total time and a latency
+  histogram. Updating the stats is lock-free and takes constant time.
+
+  The histogram uses HDR-style log-linear buckets: values below 16
+  microseconds have a bucket each, and every power of two above that is
+  split into 8 buckets, so the reported percentiles are within 12.5% of
+  the true values.
+
+  The stats are kept while the `:comeonin` application is running. They
+  can be turned off with:
+
+      config :comeonin, stats: false
+
+  """
+
+  use GenServer
+
+  import Bitwise
+
+  @table __MODULE__
+  @count 1
+  @rejected 2
+  @in_flight 3
+  @total_us 4
+  @fixed 4
+  @sub_bits 3
+  @sub_buckets 8
+  @linear 16
+  @max_exponent 35
+  @buckets @linear + (@max_exponent - 3) * @sub_buckets
+  @percentiles [50, 90, 99, 99.9]
+
+  @type token :: {:counters.counters_ref(), integer} | nil
+
+  @doc false
+  def start_link(_) do
+    GenServer.start_link(__MODULE__, [], name: __MODULE__)
+  end
+
+  @doc """
+  Marks the start of an operation.
+
+  Returns a token that should be passed to `stop/2`, or nil if the stats
+  are not running.
+  """
+  @spec start(module, atom) :: token
+  def start(module, operation) do
+    if ref = counters(module, operation) do
+      :counters.add(ref, @in_flight, 1)
+      {ref, System.monotonic_time(:microsecond)}
+    end
+  end
+
+  @doc """
+  Marks the end of an operation, with its outcome.
+  """
+  @spec stop(token, atom) :: :ok
+  def stop(nil, _outcome), do: :ok
+
+  def stop({ref, started}, outcome) do
+    duration = System.monotonic_time(:microsecond) - started
+    :counters.sub(ref, @in_flight, 1)
+    :counters.add(ref, @count, 1)
+    if outcome != :ok, do: :counters.add(ref, @rejected, 1)
+    :counters.add(ref, @total_us, duration)
+    :counters.add(ref, @fixed + 1 + bucket(duration), 1)
+  end
+
+  @doc """
+  Returns the stats for each module and operation.
+  """
+  @spec snapshot() :: [map]
+  def snapshot do
+    case :ets.whereis(@table) do
+      :undefined ->
+        []
+
+      _ ->
+        elapsed = System.monotonic_time(:microsecond) - started_at()
+
+        stats =
+          for {{module, operation}, ref} <- :ets.tab2list(@table) do
+            summary(module, operation, ref, elapsed)
+          end
+
+        Enum.sort_by(stats, &{&1.module, &1.operation})
+    end
+  end
+
+  @doc """
+  Prints the stats for each module and operation.
+  """
+  @spec report() :: :ok
+  def report do
+    for stats <- snapshot() do
+      latency = Enum.map_join(@percentiles ++ [:max], " ", &format_latency(stats, &1))
+      IO.puts("#{inspect(stats.module)}.#{stats.operation}")
+      IO.puts("  calls: #{stats.count} (#{Float.round(stats.rate, 2)}/s)")
+      IO.puts("  rejected: #{stats.rejected}, in flight: #{stats.in_flight}")
+      IO.puts("  latency (ms): mean=#{format_ms(stats.mean_us)} #{latency}")
+    end
+
+    case dirty_cpu_time() do
+      nil ->
+        IO.puts("dirty CPU schedulers: not measured (:scheduler_wall_time is disabled)")
+
+      {_active, 0} ->
+        IO.puts("dirty CPU schedulers: no samples yet")
+
+      {active, total} ->
+        busy = Float.round(active * 100 / total, 1)
+        IO.puts("dirty CPU schedulers: #{busy}% busy since :scheduler_wall_time was enabled")
+    end
+
+    for native <- native() do
+      reuse = if native.arena_reuse, do: "#{Float.round(native.arena_reuse * 100, 1)}%", else: "-"
+      IO.puts("#{inspect(native.module)} native (per call)")
+      IO.puts("  kdf: #{format_ms(native.kdf_us)} ms")
+      IO.puts("  marshalling: #{format_ms(native.marshal_us)} ms")
+      IO.puts("  wrapper: #{format_ms(native.wrapper_us)} ms")
+      IO.puts("  allocated: #{round(native.alloc_bytes)} bytes, arena reuse: #{reuse}")
+    end
+
+    if Process.whereis(Comeonin.Monitor) do
+      IO.puts("dirty CPU monitor: #{Comeonin.Monitor.report().recommendation.message}")
+    end
+
+    :ok
+  end
+
+  @doc """
+  Resets all the stats.
+  """
+  @spec reset() :: :ok
+  def reset do
+    GenServer.call(__MODULE__, :reset)
+  end
+
+  @doc """
+  Returns the native counters of the modules that have stats and
+  implement the optional `c:Comeonin.PasswordHash.native_stats/0`
+  callback, with per-call figures derived from them.
+
+  The native counters cover every call since the native code was loaded,
+  and `:wrapper_us` compares them with the wall time measured here, so it
+  is only an estimate of the time spent outside the NIFs.
+  """
+  @spec native() :: [map]
+  def native do
+    snapshot()
+    |> Enum.group_by(& &1.module)
+    |> Enum.filter(fn {module, _} ->
+      Code.ensure_loaded?(module) and function_exported?(module, :native_stats, 0)
+    end)
+    |> Enum.map(fn {module, stats} -> derive_native(module, module.native_stats(), stats) end)
+  end
+
+  defp derive_native(module, raw, stats) do
+    count = stats |> Enum.map(& &1.count) |> Enum.sum()
+    wall_us = stats |> Enum.map(&(&1.mean_us * &1.count)) |> Enum.sum()
+    mean_us = if count > 0, do: wall_us / count, else: 0.0
+    calls = Map.get(raw, :calls, 0)
+    per_call = fn key -> if calls > 0, do: Map.get(raw, key, 0) / calls, else: 0.0 end
+    reuses = Map.get(raw, :arena_reuses, 0)
+    arena_total = reuses + Map.get(raw, :arena_allocs, 0)
+
+    %{
+      module: module,
+      calls: calls,
+      kdf_us: per_call.(:kdf_us),
+      marshal_us: per_call.(:marshal_us),
+      alloc_bytes: per_call.(:alloc_bytes),
+      arena_reuse: if(arena_total > 0, do: reuses / arena_total),
+      wrapper_us: max(mean_us - per_call.(:kdf_us) - per_call.(:marshal_us), 0.0),
+      raw: raw
+    }
+  end
+
+  @doc """
+  Returns the number of calls in flight, for every module and operation.
+  """
+  @spec in_flight() :: non_neg_integer
+  def in_flight do
+    case :ets.whereis(@table) do
+      :undefined ->
+        0
+
+      table ->
+        :ets.foldl(
+          fn
+            {{_module, _operation}, ref}, acc -> acc + :counters.get(ref, @in_flight)
+            _, acc -> acc
+          end,
+          0,
+          table
+        )
+    end
+  end
+
+  @doc """
+  Returns the total busy time and the total time of the dirty CPU
+  schedulers since `:scheduler_wall_time` was enabled, or nil if it is
+  not enabled.
+
+  The unit of these times is undefined, so they are only meaningful as
+  a ratio - the busy fraction is `active / total`, and the busy fraction
+  over an interval is the ratio of the differences of two samples.
+  """
+  @spec dirty_cpu_time() :: {non_neg_integer, non_neg_integer} | nil
+  def dirty_cpu_time do
+    case :erlang.statistics(:scheduler_wall_time_all) do
+      :undefined ->
+        nil
+
+      samples ->
+        first = :erlang.system_info(:schedulers) + 1
+        last = first + :erlang.system_info(:dirty_cpu_schedulers) - 1
+
+        Enum.reduce(samples, {0, 0}, fn
+          {id, a, t}, {active, total} when id >= first and id <= last ->
+            {active + a, total + t}
+
+          _, acc ->
+            acc
+        end)
+    end
+  end
+
+  @doc false
+  def bucket(value) when value < @linear, do: max(value, 0)
+
+  def bucket(value) do
+    case bit_length(value) - 1 do
+      exponent when exponent > @max_exponent ->
+        @buckets - 1
+
+      exponent ->
+        sub = (value >>> (exponent - @sub_bits)) &&& (@sub_buckets - 1)
+        @linear + (exponent - 4) * @sub_buckets + sub
+    end
+  end
+
+  @doc false
+  def bucket_max(index) when index < @linear, do: index
+
+  def bucket_max(index) do
+    exponent = div(index - @linear, @sub_buckets) + 4
+    sub = rem(index - @linear, @sub_buckets)
+    ((@sub_buckets + sub + 1) <<< (exponent - @sub_bits)) - 1
+  end
+
+  defp bit_length(value, acc \\ 0)
+  defp bit_length(0, acc), do: acc
+  defp bit_length(value, acc), do: bit_length(value >>> 1, acc + 1)
+
+  defp counters(module, operation) do
+    case :ets.whereis(@table) do
+      :undefined ->
+        nil
+
+      table ->
+        case :ets.lookup(table, {module, operation}) do
+          [{_, ref}] -> ref
+          [] -> create(table, module, operation)
+        end
+    end
+  end
+
+  # Two processes can race to create the counters, so the one that
+  # was inserted first is looked up again and used by both.
+  defp create(table, module, operation) do
+    ref = :counters.new(@fixed + @buckets, [:write_concurrency])
+    :ets.insert_new(table, {{module, operation}, ref})
+    :ets.lookup_element(table, {module, operation}, 2)
+  end
+
+  defp started_at do
+    :ets.lookup_element(@table, :started_at, 2)
+  end
+
+  defp summary(module, operation, ref, elapsed) do
+    count = :counters.get(ref, @count)
+    histogram = read_histogram(ref)
+
+    %{
+      module: module,
+      operation: operation,
+      count: count,
+      rejected: :counters.get(ref, @rejected),
+      in_flight: :counters.get(ref, @in_flight),
+      rate: count * 1_000_000 / max(elapsed, 1),
+      mean_us: if(count > 0, do: :counters.get(ref, @total_us) / count, else: 0.0),
+      percentiles: Map.new(@percentiles ++ [:max], &{&1, percentile(histogram, &1)})
+    }
+  end
+
+  defp read_histogram(ref) do
+    for index <- 0..(@buckets - 1), do: :counters.get(ref, @fixed + 1 + index)
+  end
+
+  @doc """
+  Returns the latency histogram of an operation.
+
+  Histograms read at different times can be subtracted, bucket by bucket,
+  to get the histogram of the calls in between.
+  """
+  @spec histogram(module, atom) :: [non_neg_integer]
+  def histogram(module, operation) do
+    case counters(module, operation) do
+      nil -> []
+      ref -> read_histogram(ref)
+    end
+  end
+
+  @doc """
+  Returns the value, in microseconds, at percentile `p` (or `:max`) of a
+  histogram.
+  """
+  @spec percentile([non_neg_integer], number | :max) :: non_neg_integer
+  def percentile(histogram, p) do
+    count = Enum.sum(histogram)
+    rank = if p == :max, do: count, else: max(ceil_int(p * count / 100), 1)
+
+    histogram
+    |> Enum.with_index()
+    |> Enum.reduce_while(0, fn {bucket_count, index}, total ->
+      total = total + bucket_count
+      if total >= rank and count > 0, do: {:halt, {:found, index}}, else: {:cont, total}
+    end)
+    |> case do
+      {:found, index} -> bucket_max(index)
+      _ -> 0
+    end
+  end
+
+  defp ceil_int(value), do: trunc(Float.ceil(value / 1))
+
+  defp format_latency(stats, :max), do: "max=#{format_ms(stats.percentiles[:max])}"
+  defp format_latency(stats, p), do: "p#{p}=#{format_ms(stats.percentiles[p])}"
+
+  defp format_ms(us), do: Float.round(us / 1000, 2)
+
+  @impl true
+  def init(_) do
+    :ets.new(@table, [:named_table, :public, read_concurrency: true])
+    :ets.insert(@table, {:started_at, System.monotonic_time(:microsecond)})
+    {:ok, nil}
+  end
+
+  @impl true
+  def handle_call(:reset, _from, state) do
+    :ets.delete_all_objects(@table)
+    :ets.insert(@table, {:started_at, System.monotonic_time(:microsecond)})
+    {:reply, :ok, state}
+  end
+end
@@ -0,0 +1,125 @@
+defmodule Comeonin.Ticket do
+  @moduledoc """
+  Short-lived, signed tickets for step-up re-authentication.
+
+  Sensitive actions are often protected by asking for the password again
+  ("sudo mode"), and each prompt costs a full verification. When
+  `check_pass/3` is called with the `ticket: true` option, it returns a
+  ticket as well as the user, and `verify_ticket/3` can then be used,
+  until the ticket expires, instead of asking for the password again.
+  Checking a ticket is an HMAC, which takes microseconds.
+
+  A ticket is bound to the user's id, an expiry time and a SHA-256 digest
+  of the stored password hash, so it stops working as soon as the
+  password is changed. The ticket does not contain the hash or anything
+  that could be used to guess the password.
+
+  ## Options
+
+    * `:ticket_secret` - the HMAC key, of at least 32 bytes
+      * the default is the `:ticket_secret` config of the `:comeonin`
+        application
+    * `:ticket_ttl` - the lifetime of a ticket, in seconds
+      * the default is 300
+    * `:user_id_key` - the key of the user id in the user struct, or map
+      * the default is `:id`, or `"id"` for maps with string keys and
+        keyword lists
+
+  No ticket is issued, or accepted, for a user without an id.
+  """
+
+  @version 1
+  @min_secret_size 32
+
+  @doc """
+  Issues a ticket for a user id and stored password hash.
+  """
+  @spec issue(term, binary, keyword) :: binary
+  def issue(user_id, hash, opts \\ []) do
+    expires_at = System.system_time(:second) + Keyword.get(opts, :ticket_ttl, 300)
+    mac = mac(user_id, hash, expires_at, opts)
+    Base.url_encode64(<<@version, expires_at::64, mac::binary>>, padding: false)
+  end
+
+  @doc """
+  Checks a ticket for a user id and stored password hash.
+
+  Anything that is not a ticket, including nil, is invalid.
+  """
+  @spec verify(term, binary, term, keyword) :: :ok | {:error, :expired | :invalid}
+  def verify(user_id, hash, ticket, opts \\ [])
+
+  def verify(nil, _hash, _ticket, _opts), do: {:error, :invalid}
+
+  def verify(user_id, hash, ticket, opts) when is_binary(ticket) do
+    case Base.url_decode64(ticket, padding: false) do
+      {:ok, <<@version, expires_at::64, mac::binary-32>>} ->
+        expected = mac(user_id, hash, expires_at, opts)
+
+        cond do
+          not Comeonin.SecureCompare.equal?(mac, expected) -> {:error, :invalid}
+          expires_at < System.system_time(:second) -> {:error, :expired}
+          true -> :ok
+        end
+
+      _ ->
+        {:error, :invalid}
+    end
+  end
+
+  def verify(_user_id, _hash, _ticket, _opts), do: {:error, :invalid}
+
+  @doc """
+  Returns the user id, using the `:user_id_key` option.
+
+  As with the `:hash_key` option of `check_pass/3`, the key can be a
+  position in a list or tuple row, or a function that takes the user.
+  Without the option, `:id` and then `"id"` are tried. Returns nil if the
+  user has no such key or position.
+  """
+  @spec user_id(term, keyword) :: term
+  def user_id(user, opts) do
+    case Keyword.fetch(opts, :user_id_key) do
+      {:ok, key} ->
+        fetch(user, key)
+
+      :error ->
+        with nil <- fetch(user, :id), do: fetch(user, "id")
+    end
+  end
+
+  defp fetch(user, key) when is_function(key, 1), do: key.(user)
+
+  defp fetch(row, index) when is_tuple(row) and is_integer(index) do
+    if index >= 0 and index < tuple_size(row), do: elem(row, index)
+  end
+
+  defp fetch(row, index) when is_list(row) and is_integer(index), do: Enum.at(row, index)
+  defp fetch(row, key) when is_list(row), do: row |> List.keyfind(key, 0, {key, nil}) |> elem(1)
+  defp fetch(user, key) when is_map(user), do: Map.get(user, key)
+  defp fetch(_user, _key), do: nil
+
+  defp mac(user_id, hash, expires_at, opts) do
+    data = [:erlang.term_to_binary(user_id), <<expires_at::64>>, :crypto.hash(:sha256, hash)]
+    hmac(secret(opts), data)
+  end
+
+  # :crypto.hmac/3 was removed in OTP 24, and :crypto.mac/4 was added in 22.1
+  if Code.ensure_loaded?(:crypto) and function_exported?(:crypto, :mac, 4) do
+    defp hmac(key, data), do: :crypto.mac(:hmac, :sha256, key, data)
+  else
+    defp hmac(key, data), do: :crypto.hmac(:sha256, key, data)
+  end
+
+  defp secret(opts) do
+    case opts[:ticket_secret] || Application.get_env(:comeonin, :ticket_secret) do
+      secret when is_binary(secret) and byte_size(secret) >= @min_secret_size ->
+        secret
+
+      _ ->
+        raise ArgumentError,
+              "tickets need a :ticket_secret of at least #{@min_secret_size} bytes, " <>
+                "set in the options or in the :comeonin config"
+    end
+  end
+end
@@ -0,0 +1,25 @@
+defmodule Mix.Comeonin do
+  @moduledoc false
+
+  @doc """
+  Returns the implementation module given with the `--module` option.
+  """
+  def module!(opts) do
+    case opts[:module] do
+      nil -> Mix.raise("The --module option is required")
+      module -> Module.concat([module])
+    end
+  end
+
+  @doc """
+  Parses integer hashing options, such as `"t_cost=1;m_cost=12"`.
+  """
+  def parse_opts(nil), do: []
+
+  def parse_opts(opts) do
+    for opt <- String.split(opts, ";", trim: true) do
+      [key, value] = String.split(opt, "=", parts: 2)
+      {String.to_atom(String.trim(key)), String.to_integer(String.trim(value))}
+    end
+  end
+end
@@ -0,0 +1,162 @@
+defmodule Mix.Tasks.Comeonin.Bench do
+  use Mix.Task
+
+  @shortdoc "Benchmarks password hashing implementations over a grid of options"
+
+  @moduledoc """
+  Benchmarks password hashing implementations over a grid of options.
+
+      mix comeonin.bench
+      mix comeonin.bench --module Argon2 --grid "t_cost=1,2,3;m_cost=15,16"
+
+  Without the `--module` option, the implementations and grids in the
+  `:benchmark` config are used, or the baseline if it is not set (see
+  `Comeonin.Benchmark`).
+
+  For each configuration, the verify time, the memory per verification
+  and the estimated attacker cost are printed, and the Pareto-optimal
+  configurations are marked with an asterisk. The verify time is also
+  given relative to the baseline, `Comeonin.Pbkdf2Hmac` with its default
+  options, when it is available (see `Comeonin.Benchmark.baseline/0`).
+
+  ## Options
+
+    * `--module` - the implementation to benchmark (can be repeated)
+    * `--grid` - the options to sweep for the `--module` implementations
+      * keys are separated by `;` and values by `,`
+      * values must be integers
+    * `--runs` - the number of timed verifications per configuration
+    * `--output` - write the results to a costs file, which can be used
+      by `mix comeonin.inventory` and `mix comeonin.capacity`
+    * `--no-baseline` - do not measure the baseline
+    * `--secure-compare` - benchmark `Comeonin.SecureCompare.equal?/2`
+      instead of the implementations
+  """
+
+  @switches [
+    module: :keep,
+    grid: :string,
+    runs: :integer,
+    output: :string,
+    baseline: :boolean,
+    secure_compare: :boolean
+  ]
+
+  @impl Mix.Task
+  def run(args) do
+    Mix.Task.run("app.start")
+    {opts, _} = OptionParser.parse!(args, strict: @switches)
+
+    if opts[:secure_compare] do
+      print_secure_compare(Comeonin.Benchmark.secure_compare())
+    else
+      run_matrix(opts)
+    end
+  end
+
+  defp run_matrix(opts) do
+    bench_opts = Keyword.take(opts, [:runs])
+    results = Comeonin.Benchmark.matrix(specs(opts), bench_opts)
+    print(results, baseline(opts, bench_opts))
+
+    if path = opts[:output] do
+      Comeonin.Benchmark.write_costs(path, results)
+      Mix.shell().info("Costs written to #{path}")
+    end
+  end
+
+  defp specs(opts) do
+    specs =
+      case Keyword.get_values(opts, :module) do
+        [] -> Comeonin.Benchmark.configured()
+        modules -> Enum.map(modules, &{Module.concat([&1]), parse_grid(opts[:grid])})
+      end
+
+    if specs == [] do
+      Mix.raise("No implementations to benchmark - use --module or set the :benchmark config")
+    end
+
+    specs
+  end
+
+  defp baseline(opts, bench_opts) do
+    with true <- Keyword.get(opts, :baseline, true),
+         {module, hash_opts} <- Comeonin.Benchmark.baseline() do
+      Comeonin.Benchmark.measure(module, hash_opts, bench_opts)
+    else
+      _ -> nil
+    end
+  end
+
+  defp parse_grid(nil), do: []
+
+  defp parse_grid(grid) do
+    for param <- String.split(grid, ";", trim: true) do
+      [key, values] = String.split(param, "=", parts: 2)
+      {String.to_atom(String.trim(key)), Enum.map(String.split(values, ","), &to_integer/1)}
+    end
+  end
+
+  defp to_integer(value), do: value |> String.trim() |> String.to_integer()
+
+  defp print(results, baseline) do
+    ["", "module", "options", "params", "verify ms", "memory KiB", "attacker cost", "x baseline"]
+    |> format_row()
+    |> Mix.shell().info()
+
+    for result <- Enum.sort_by(results, & &1.verify_us) do
+      [
+        if(result.pareto, do: "*", else: ""),
+        inspect(result.module),
+        inspect(result.opts),
+        result.prefix || "-",
+        :erlang.float_to_binary(result.verify_us / 1000, decimals: 2),
+        Integer.to_string(div(result.memory, 1024)),
+        :erlang.float_to_binary(result.attacker_cost / 1, decimals: 0),
+        relative(result, baseline)
+      ]
+      |> format_row()
+      |> Mix.shell().info()
+    end
+
+    if baseline do
+      ms = :erlang.float_to_binary(baseline.verify_us / 1000, decimals: 2)
+      Mix.shell().info("baseline: #{inspect(baseline.module)} #{baseline.prefix} #{ms} ms")
+    end
+  end
+
+  defp relative(_result, nil), do: "-"
+  defp relative(_result, %{verify_us: 0}), do: "-"
+
+  defp relative(result, baseline) do
+    :erlang.float_to_binary(result.verify_us / baseline.verify_us, decimals: 2)
+  end
+
+  defp print_secure_compare(results) do
+    Mix.shell().info("ns per comparison: equal / first byte differs / last byte differs")
+
+    for result <- results, impl <- [:secure, :bytewise] do
+      times =
+        Enum.map_join([:equal, :first_differs, :last_differs], " / ", fn name ->
+          :erlang.float_to_binary(result[{impl, name}] / 1, decimals: 1)
+        end)
+
+      size = String.pad_leading(Integer.to_string(result.size), 5)
+      Mix.shell().info("#{size} bytes  #{String.pad_trailing(to_string(impl), 9)}#{times}")
+    end
+  end
+
+  defp format_row([mark, module, options, params, verify, memory, cost, relative]) do
+    [
+      String.pad_trailing(mark, 2),
+      String.pad_trailing(module, 12),
+      String.pad_trailing(options, 30),
+      String.pad_trailing(params, 34),
+      String.pad_leading(verify, 10),
+      String.pad_leading(memory, 11),
+      String.pad_leading(cost, 15),
+      String.pad_leading(relative, 12)
+    ]
+    |> IO.iodata_to_binary()
+  end
+end
@@ -0,0 +1,95 @@
+defmodule Mix.Tasks.Comeonin.Capacity do
+  use Mix.Task
+
+  @shortdoc "Plans the cores, dirty schedulers and memory needed for a login rate"
+
+  @moduledoc """
+  Plans the cores, dirty schedulers and memory needed to verify logins at
+  a target rate and p99 latency (see `Comeonin.Capacity`).
+
+      mix comeonin.capacity --costs costs.tsv --inventory inventory.tsv --qps 200 --p99 500
+      mix comeonin.capacity --costs costs.tsv --inventory inventory.tsv --qps 200 --p99 500 \\
+        --set argon2id:t=4
+
+  ## Options
+
+    * `--costs` - a costs file from `mix comeonin.bench` (required)
+    * `--inventory` - an inventory file from `mix comeonin.inventory`
+      (required)
+    * `--qps` - the target number of logins per second (required)
+    * `--p99` - the p99 latency target, in milliseconds (required)
+    * `--set` - a what-if change, `algorithm:param=value`, applied to
+      every stored hash of the algorithm (can be repeated)
+      * for example, `argon2id:t=4`, `2b:cost=12` or `pbkdf2-sha512:rounds=210000`
+      * the plan with the changes is printed after the current plan
+  """
+
+  @switches [costs: :string, inventory: :string, qps: :float, p99: :float, set: :keep]
+
+  @impl Mix.Task
+  def run(args) do
+    {opts, _} = OptionParser.parse!(args, strict: @switches)
+
+    for key <- [:costs, :inventory, :qps, :p99], is_nil(opts[key]) do
+      Mix.raise("The --#{key} option is required")
+    end
+
+    costs = Comeonin.Benchmark.read_costs(opts[:costs])
+    inventory = Comeonin.Inventory.read(opts[:inventory])
+    plan_opts = [qps: opts[:qps], p99_ms: opts[:p99]]
+
+    Mix.shell().info("Current parameters")
+    print(Comeonin.Capacity.plan(inventory, costs, plan_opts))
+
+    case Keyword.get_values(opts, :set) do
+      [] ->
+        :ok
+
+      changes ->
+        Mix.shell().info("\nWith #{Enum.join(changes, ", ")}")
+        inventory = Comeonin.Capacity.what_if(inventory, Enum.map(changes, &parse_change/1))
+        print(Comeonin.Capacity.plan(inventory, costs, plan_opts))
+    end
+  end
+
+  defp parse_change(change) do
+    case Comeonin.Capacity.parse_change(change) do
+      {:ok, change} -> change
+      :error -> Mix.raise("Invalid --set #{inspect(change)} - use algorithm:param=value")
+    end
+  end
+
+  defp print({:error, reason}), do: Mix.shell().info("  not possible: #{reason}")
+
+  defp print({:ok, plan}) do
+    for entry <- plan.entries do
+      share = Float.round(entry.share * 100, 2)
+      marker = if entry.prefix in plan.estimated, do: " (estimated)", else: ""
+      label = String.pad_trailing(entry.prefix, 40)
+      Mix.shell().info("  #{label}#{pad(share)}%#{pad(format_ms(entry.verify_us))} ms#{marker}")
+    end
+
+    for prefix <- plan.missing do
+      Mix.shell().info("  no cost for #{prefix} - left out of the plan")
+    end
+
+    lines = [
+      "mean verify time: #{format_ms(plan.mean_verify_us)} ms",
+      "p99 verify time: #{format_ms(plan.p99_verify_us)} ms",
+      "offered load: #{Float.round(plan.load / 1, 2)} schedulers",
+      "dirty CPU schedulers (+SDcpu): #{plan.dirty_cpu_schedulers}",
+      "cores: #{plan.cores}",
+      "memory for hashing: #{format_mib(plan.memory)} MiB",
+      "utilization: #{Float.round(plan.utilization * 100, 1)}%",
+      "predicted p99 latency: #{format_ms(plan.p99_us)} ms"
+    ]
+
+    Enum.each(lines, &Mix.shell().info("  " <> &1))
+  end
+
+  defp pad(value), do: String.pad_leading(to_string(value), 10)
+
+  defp format_ms(us), do: Float.round(us / 1000, 2)
+
+  defp format_mib(bytes), do: Float.round(bytes / (1024 * 1024), 1)
+end
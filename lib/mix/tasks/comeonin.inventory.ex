@@ -0,0 +1,80 @@
+defmodule Mix.Tasks.Comeonin.Inventory do
+  use Mix.Task
+
+  @shortdoc "Counts the algorithms and parameters of exported password hashes"
+
+  @moduledoc """
+  Counts the algorithms and parameters of the password hashes in a file,
+  such as an export of the password hash column (see `Comeonin.Inventory`).
+
+      mix comeonin.inventory hashes.txt
+      mix comeonin.inventory users.csv --column 2 --costs costs.tsv --output inventory.tsv
+
+  ## Options
+
+    * `--column` - the 0-based column of the hash, for delimited input
+    * `--separator` - the column separator (the default is `,`)
+    * `--costs` - a costs file from `mix comeonin.bench`, used to project
+      the CPU time needed per 1000 logins
+    * `--output` - write the inventory to a file, which can be used by
+      `mix comeonin.capacity`
+  """
+
+  @switches [column: :integer, separator: :string, costs: :string, output: :string]
+
+  @impl Mix.Task
+  def run(args) do
+    Mix.Task.run("app.start")
+
+    {opts, path} =
+      case OptionParser.parse!(args, strict: @switches) do
+        {opts, [path]} -> {opts, path}
+        _ -> Mix.raise("Usage: mix comeonin.inventory FILE [options]")
+      end
+
+    inventory =
+      path
+      |> File.stream!(read_ahead: 1_000_000)
+      |> Comeonin.Inventory.scan(Keyword.take(opts, [:column, :separator]))
+
+    print(inventory)
+
+    if path = opts[:costs] do
+      costs = Comeonin.Benchmark.read_costs(path)
+      print_projection(Comeonin.Inventory.project(inventory, costs))
+    end
+
+    if output = opts[:output] do
+      Comeonin.Inventory.write(output, inventory)
+      Mix.shell().info("Inventory written to #{output}")
+    end
+  end
+
+  defp print(inventory) do
+    {unknown, entries} = Map.pop(inventory, :unknown, 0)
+    total = Enum.reduce(entries, unknown, fn {_, %{count: count}}, acc -> acc + count end)
+
+    for {prefix, %{count: count}} <- Enum.sort_by(entries, fn {_, entry} -> -entry.count end) do
+      share = Float.round(count * 100 / max(total, 1), 2)
+      print_row(prefix, count, "  #{share}%")
+    end
+
+    print_row("unknown", unknown, "")
+    print_row("total", total, "")
+  end
+
+  defp print_row(label, count, suffix) do
+    count = String.pad_leading(Integer.to_string(count), 14)
+    Mix.shell().info("#{String.pad_trailing(label, 40)}#{count}#{suffix}")
+  end
+
+  defp print_projection(projection) do
+    cpu = Float.round(projection.cpu_seconds_per_1k, 3)
+    covered = Float.round(projection.covered * 100, 2)
+    Mix.shell().info("CPU-seconds per 1k logins: #{cpu} (#{covered}% of hashes have a cost)")
+
+    for prefix <- projection.missing do
+      Mix.shell().info("  no cost for #{prefix}")
+    end
+  end
+end
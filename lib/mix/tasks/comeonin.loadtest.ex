@@ -0,0 +1,115 @@
+defmodule Mix.Tasks.Comeonin.Loadtest do
+  use Mix.Task
+
+  @shortdoc "Drives check_pass/3 with open-loop login traffic"
+
+  @moduledoc """
+  Drives the `check_pass/3` function of an implementation with open-loop
+  login traffic (see `Comeonin.LoadTest`).
+
+      mix comeonin.loadtest --module Argon2 --rate 20 --duration 30
+      mix comeonin.loadtest --module Bcrypt --arrival bursty --burst-size 50
+      mix comeonin.loadtest --module Argon2 --mix "valid=50,wrong_password=50"
+      mix comeonin.loadtest --module Argon2 --trace logins.trace --speed 2
+
+  ## Options
+
+    * `--module` - the implementation to test (required)
+    * `--rate` - the mean number of arrivals per second
+    * `--duration` - the length of the test, in seconds
+    * `--arrival` - `poisson` or `bursty`
+    * `--burst-size` - the mean batch size for bursty arrivals
+    * `--mix` - the weights for the `valid`, `wrong_password`, `nil_user`
+      and `missing_hash` requests
+    * `--concurrency` - the number of requests served at the same time
+    * `--opts` - integer options for `hash_pwd_salt/2`, such as `"t_cost=1;m_cost=12"`
+    * `--trace` - replay a trace written by `Comeonin.Recorder`, instead of
+      generating arrivals
+    * `--speed` - how much faster than real time the trace is replayed
+  """
+
+  @switches [
+    module: :string,
+    rate: :float,
+    duration: :float,
+    arrival: :string,
+    burst_size: :integer,
+    mix: :string,
+    concurrency: :integer,
+    opts: :string,
+    trace: :string,
+    speed: :float
+  ]
+
+  @kinds ~w(valid wrong_password nil_user missing_hash)
+
+  @impl Mix.Task
+  def run(args) do
+    Mix.Task.run("app.start")
+    {opts, _} = OptionParser.parse!(args, strict: @switches)
+    module = Mix.Comeonin.module!(opts)
+
+    report =
+      case opts[:trace] do
+        nil -> Comeonin.LoadTest.run(module, load_opts(opts))
+        path -> Comeonin.Recorder.replay(path, module, load_opts(opts))
+      end
+
+    print(report)
+  end
+
+  @doc false
+  def load_opts(opts) do
+    opts
+    |> Keyword.take([:rate, :duration, :burst_size, :concurrency, :speed])
+    |> put_opt(:arrival, opts[:arrival], &parse_arrival/1)
+    |> put_opt(:mix, opts[:mix], &parse_mix/1)
+    |> put_opt(:hash_opts, opts[:opts], &Mix.Comeonin.parse_opts/1)
+  end
+
+  defp put_opt(opts, _key, nil, _fun), do: opts
+  defp put_opt(opts, key, value, fun), do: Keyword.put(opts, key, fun.(value))
+
+  defp parse_arrival("poisson"), do: :poisson
+  defp parse_arrival("bursty"), do: :bursty
+  defp parse_arrival(arrival), do: Mix.raise("Unknown arrival process #{inspect(arrival)}")
+
+  defp parse_mix(mix) do
+    for weight <- String.split(mix, ",", trim: true) do
+      [kind, value] = String.split(weight, "=", parts: 2)
+      kind = String.trim(kind)
+      unless kind in @kinds, do: Mix.raise("Unknown request kind #{inspect(kind)}")
+      {String.to_atom(kind), String.to_integer(String.trim(value))}
+    end
+  end
+
+  @doc false
+  def print(report) do
+    info = &Mix.shell().info/1
+    info.("requests:        #{report.requests}")
+    info.("throughput:      #{Float.round(report.throughput, 2)} req/s")
+    info.("latency (ms):    #{format_percentiles(report.latency, 1000)}")
+    info.("service (ms):    #{format_percentiles(report.service_latency, 1000)}")
+    info.("queue depth:     #{format_percentiles(report.queue_depth, 1)}")
+
+    for {type, utilization} <- Enum.sort(report.scheduler_utilization) do
+      info.("#{String.pad_trailing("#{type} util:", 17)}#{Float.round(utilization * 100, 1)}%")
+    end
+
+    for {{kind, outcome}, count} <- Enum.sort(report.outcomes) do
+      info.("#{String.pad_trailing("#{kind} #{outcome}:", 17)}#{count}")
+    end
+  end
+
+  defp format_percentiles(percentiles, divisor) do
+    percentiles
+    |> Enum.sort_by(fn
+      {:max, _} -> 100.0
+      {p, _} -> p
+    end)
+    |> Enum.map_join("  ", fn {p, value} ->
+      label = if p == :max, do: "max", else: "p#{p}"
+      "#{label}=#{Float.round(value / divisor, 2)}"
+    end)
+  end
+end
@@ -0,0 +1,69 @@
+defmodule Mix.Tasks.Comeonin.Profile do
+  use Mix.Task
+
+  @shortdoc "Profiles where the time in add_hash and check_pass goes"
+
+  @moduledoc """
+  Profiles the `add_hash/2` and `check_pass/3` functions of an
+  implementation, and separates the time spent in Comeonin and option
+  handling, salt generation and the key derivation function (see
+  `Comeonin.Profile`).
+
+      mix comeonin.profile --module Argon2 --opts "t_cost=1;m_cost=12"
+      mix comeonin.profile --module Bcrypt --runs 50 --perf
+
+  The output file contains folded stacks, which can be passed to
+  `flamegraph.pl` or loaded into speedscope.
+
+  ## Options
+
+    * `--module` - the implementation to profile (required)
+    * `--opts` - integer options for `hash_pwd_salt/2`
+    * `--runs` - the number of `add_hash/2` and `check_pass/3` calls
+      * the default is 20
+    * `--perf` - also sample the native code with Linux `perf`, if it is installed
+    * `--output` - the folded stacks file
+      * the default is `comeonin_profile.folded`
+  """
+
+  @switches [module: :string, opts: :string, runs: :integer, perf: :boolean, output: :string]
+
+  @impl Mix.Task
+  def run(args) do
+    Mix.Task.run("app.start")
+    {opts, _} = OptionParser.parse!(args, strict: @switches)
+    module = Mix.Comeonin.module!(opts)
+    hash_opts = Mix.Comeonin.parse_opts(opts[:opts])
+    output = opts[:output] || "comeonin_profile.folded"
+    workload = Comeonin.Profile.workload(module, hash_opts, opts[:runs] || 20)
+
+    times = Comeonin.Profile.call_times(workload)
+    print_totals(Comeonin.Profile.totals(times, module))
+    native = if opts[:perf], do: perf(workload), else: []
+
+    File.write!(output, Enum.map(Comeonin.Profile.fold(times, module) ++ native, &[&1, "\n"]))
+    Mix.shell().info("Folded stacks written to #{output}")
+  end
+
+  defp perf(workload) do
+    case Comeonin.Profile.perf(workload) do
+      {:ok, stacks} ->
+        stacks
+
+      {:error, reason} ->
+        Mix.shell().error("Skipping native profile: #{reason}")
+        []
+    end
+  end
+
+  defp print_totals(totals) do
+    total = max(Enum.sum(Map.values(totals)), 1)
+
+    for category <- [:wrapper, :salt, :kdf] do
+      time = totals[category]
+      label = String.pad_trailing("#{category}:", 9)
+      ms = String.pad_leading(Integer.to_string(div(time, 1000)), 8)
+      Mix.shell().info("#{label}#{ms} ms  #{Float.round(time * 100 / total, 1)}%")
+    end
+  end
+end
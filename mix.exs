@@ -24,7 +24,8 @@ defmodule Comeonin.Mixfile do
 
   def application do
     [
-      extra_applications: [:logger]
+      extra_applications: [:logger, :crypto],
+      mod: {Comeonin.Application, []}
     ]
   end
 
@@ -0,0 +1,52 @@
+defmodule Comeonin.AutoTunerTest do
+  use ExUnit.Case
+
+  alias Comeonin.{AutoTuner, CostHash}
+
+  @config %{floor: 2, ceiling: 6, step: 1, scale: :linear, target_ms: 100, headroom: 0.2}
+
+  test "decide lowers the cost when the latency is above the target" do
+    assert {3, reason} = AutoTuner.decide(4, 150_000, 0.1, @config)
+    assert reason =~ "above the 100 ms target"
+  end
+
+  test "decide lowers the cost when the dirty CPU schedulers are too busy" do
+    assert {3, reason} = AutoTuner.decide(4, 50_000, 0.9, @config)
+    assert reason =~ "headroom"
+  end
+
+  test "decide raises the cost when the prediction is under the target" do
+    assert {5, _} = AutoTuner.decide(4, 40_000, 0.1, @config)
+    assert {4, "unchanged"} = AutoTuner.decide(4, 70_000, 0.1, @config)
+    assert {4, "unchanged"} = AutoTuner.decide(4, 40_000, 0.7, @config)
+    assert {4, _} = AutoTuner.decide(3, 30_000, nil, %{@config | scale: :exponential})
+    assert {3, "unchanged"} = AutoTuner.decide(3, 50_000, nil, %{@config | scale: :exponential})
+  end
+
+  test "decide stays between the floor and the ceiling" do
+    assert {2, "unchanged"} = AutoTuner.decide(2, 500_000, 0.99, @config)
+    assert {6, "unchanged"} = AutoTuner.decide(6, 1_000, 0.0, @config)
+  end
+
+  test "the tuned options are defaults for hash_pwd_salt" do
+    assert AutoTuner.opts(CostHash) == []
+
+    opts = [module: CostHash, param: :rounds, floor: 10, ceiling: 12, interval: 60_000]
+    pid = start_supervised!({AutoTuner, opts})
+    assert AutoTuner.opts(CostHash) == [rounds: 10]
+    assert CostHash.hash_pwd_salt("password") == "password:10"
+    assert CostHash.hash_pwd_salt("password", rounds: 20) == "password:20"
+
+    send(pid, :tune)
+    :sys.get_state(pid)
+    assert AutoTuner.opts(CostHash) == [rounds: 11]
+    assert %{password_hash: "password:11"} = CostHash.add_hash("password")
+
+    :ok = stop_supervised({AutoTuner, CostHash})
+    assert AutoTuner.opts(CostHash) == []
+  end
+
+  test "needs_rehash? is false when the module is not tuned" do
+    refute AutoTuner.needs_rehash?(CostHash, "password:1000")
+  end
+end
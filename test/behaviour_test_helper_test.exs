@@ -1,5 +1,5 @@
 defmodule Comeonin.BehaviourTestHelperTest do
-  use ExUnit.Case
+  use ExUnit.Case, async: true
 
   import Comeonin.BehaviourTestHelper
 
@@ -31,4 +31,62 @@ defmodule Comeonin.BehaviourTestHelperTest do
     refute check_pass_returns_error(Comeonin.FailHash, password)
     assert check_pass_nil_user(Comeonin.TestHash)
   end
+
+  test "checks pass options on to the implementation" do
+    password = Enum.random(non_ascii_passwords())
+    opts = [rounds: 7]
+    mfa = {Comeonin.CostHash, :hash_pwd_salt, 2}
+    :erlang.trace_pattern(mfa, [{:_, [], [{:return_trace}]}], [:local])
+    :erlang.trace(self(), true, [:call])
+
+    assert correct_password_true(Comeonin.CostHash, password, opts)
+    assert wrong_password_false(Comeonin.CostHash, password, opts)
+    assert add_hash_creates_map(Comeonin.CostHash, password, opts)
+    assert check_pass_returns_user(Comeonin.CostHash, password, opts)
+    assert check_pass_returns_error(Comeonin.CostHash, password, opts)
+    assert check_pass_nil_user(Comeonin.CostHash, opts)
+    refute check_pass_returns_error(Comeonin.FailHash, password, opts)
+
+    :erlang.trace(self(), false, [:call])
+    :erlang.trace_pattern(mfa, false, [:local])
+    hashes = traced_hashes(mfa, :erlang.trace_delivered(self()))
+    assert length(hashes) >= 6
+    assert Enum.all?(hashes, &String.ends_with?(&1, ":7"))
+  end
+
+  test "large and edge-case inputs hash and verify" do
+    for password <- long_passwords() ++ unicode_heavy_passwords() ++ binary_edge_passwords() do
+      assert correct_password_true(Comeonin.TestHash, password)
+    end
+  end
+
+  test "password streams generate passwords of the requested kind" do
+    assert [password] = Enum.take(password_stream(:unicode, length: 20), 1)
+    assert String.valid?(password) and length(String.codepoints(password)) == 20
+    assert [password] = Enum.take(password_stream(:ascii, length: 8), 1)
+    assert password =~ ~r/^[!-~]{8}$/
+    assert [<<_::binary-size(32)>>] = Enum.take(password_stream(:binary, length: 32), 1)
+    assert Enum.take(password_stream(:ascii, length: 0), 1) == [""]
+  end
+
+  test "corpus checks" do
+    corpus = Enum.take(password_corpus(), 200)
+    assert length(corpus) == 200
+    assert corpus_verifies(Comeonin.TestHash, corpus)
+    refute corpus_verifies(Comeonin.FailHash, corpus)
+  end
+
+  test "time checks" do
+    assert hash_time_bounded(Comeonin.TestHash)
+    assert multibyte_time_stable(Comeonin.TestHash)
+    refute hash_time_bounded(Comeonin.SlowHash)
+  end
+
+  defp traced_hashes(mfa, ref) do
+    receive do
+      {:trace, _, :return_from, ^mfa, hash} -> [hash | traced_hashes(mfa, ref)]
+      {:trace, _, :call, ^mfa, _args} -> traced_hashes(mfa, ref)
+      {:trace_delivered, _, ^ref} -> []
+    end
+  end
 end
@@ -0,0 +1,42 @@
+defmodule Comeonin.BenchmarkTest do
+  use ExUnit.Case, async: true
+
+  alias Comeonin.Benchmark
+
+  doctest Benchmark
+
+  test "expands a grid of options" do
+    assert Benchmark.expand_grid(a: [1, 2], b: [3, 4]) == [
+             [a: 1, b: 3],
+             [a: 1, b: 4],
+             [a: 2, b: 3],
+             [a: 2, b: 4]
+           ]
+
+    assert Benchmark.expand_grid([]) == [[]]
+  end
+
+  test "marks the Pareto-optimal configurations" do
+    results =
+      for {verify_us, attacker_cost} <- [{10, 100}, {20, 50}, {20, 300}, {30, 300}] do
+        %{verify_us: verify_us, attacker_cost: attacker_cost, pareto: false}
+      end
+
+    assert Enum.map(Benchmark.mark_pareto(results), & &1.pareto) == [true, false, true, false]
+  end
+
+  test "measures each configuration" do
+    assert [result] = Benchmark.matrix([{Comeonin.TestHash, []}], runs: 1)
+    assert result.module == Comeonin.TestHash
+    assert result.pareto
+    assert result.attacker_cost == Benchmark.attacker_cost(result.verify_us, result.memory)
+  end
+
+  test "writes and reads costs files" do
+    path = Path.join(System.tmp_dir!(), "comeonin_costs_#{System.unique_integer([:positive])}")
+    result = %{prefix: "$2b$12", verify_us: 250_000, memory: 4096, module: Bcrypt, opts: []}
+    Benchmark.write_costs(path, [result, %{result | prefix: nil}])
+    assert Benchmark.read_costs(path) == %{"$2b$12" => %{verify_us: 250_000, memory: 4096}}
+    File.rm!(path)
+  end
+end
@@ -0,0 +1,67 @@
+defmodule Comeonin.CapacityTest do
+  use ExUnit.Case, async: true
+
+  alias Comeonin.Capacity
+
+  doctest Capacity
+
+  @argon2 "$argon2id$v=19$m=65536,t=3,p=4"
+  @memory 64 * 1024 * 1024
+
+  @inventory %{
+    "$2b$10" => %{algorithm: "2b", params: %{"cost" => 10}, count: 99},
+    @argon2 => %{algorithm: "argon2id", params: %{"m" => 65536, "t" => 3, "p" => 4}, count: 1},
+    :unknown => 7
+  }
+
+  @costs %{
+    "$2b$10" => %{verify_us: 50_000, memory: 4096},
+    @argon2 => %{verify_us: 90_000, memory: @memory}
+  }
+
+  test "erlang_c gives the probability of waiting" do
+    assert_in_delta Capacity.erlang_c(2, 1), 1 / 3, 1.0e-9
+    assert Capacity.erlang_c(4, 4) == 1.0
+    assert Capacity.erlang_c(100, 10) < 1.0e-6
+  end
+
+  test "plans schedulers, cores and memory for a login rate" do
+    assert {:ok, plan} = Capacity.plan(@inventory, @costs, qps: 100, p99_ms: 100)
+    assert plan.mean_verify_us == 50_400
+    assert plan.p99_verify_us == 50_000
+    assert_in_delta plan.load, 5.04, 1.0e-9
+    assert plan.dirty_cpu_schedulers > 5 and plan.cores == plan.dirty_cpu_schedulers
+    assert plan.p99_us <= 100_000
+    assert plan.memory == plan.dirty_cpu_schedulers * @memory
+    assert plan.estimated == [] and plan.missing == []
+
+    assert {:ok, tight} = Capacity.plan(@inventory, @costs, qps: 100, p99_ms: 60)
+    assert tight.dirty_cpu_schedulers > plan.dirty_cpu_schedulers
+  end
+
+  test "returns an error if the verify time alone is above the target" do
+    assert {:error, _} = Capacity.plan(@inventory, @costs, qps: 10, p99_ms: 40)
+    assert {:error, _} = Capacity.plan(@inventory, %{}, qps: 10, p99_ms: 40)
+  end
+
+  test "answers what-if questions with estimated costs" do
+    assert {:ok, change} = Capacity.parse_change("argon2id:t=4")
+    assert Capacity.parse_change("argon2id") == :error
+
+    inventory = Capacity.what_if(@inventory, [change, {"2b", "cost", 12}])
+    assert inventory["$argon2id$v=19$m=65536,t=4,p=4"].count == 1
+    assert inventory["$2b$12"].count == 99
+    assert inventory[:unknown] == 7
+
+    assert {:ok, plan} = Capacity.plan(inventory, @costs, qps: 10, p99_ms: 1000)
+    assert plan.estimated == ["$2b$12", "$argon2id$v=19$m=65536,t=4,p=4"]
+    assert Enum.map(plan.entries, & &1.verify_us) == [200_000, 120_000]
+  end
+
+  test "lists the hashes of algorithms with no costs as missing" do
+    entry = %{algorithm: "pbkdf2-sha512", params: %{"rounds" => 1000}, count: 5}
+    inventory = Map.put(@inventory, "$pbkdf2-sha512$1000", entry)
+    assert {:ok, plan} = Capacity.plan(inventory, @costs, qps: 10, p99_ms: 1000)
+    assert plan.missing == ["$pbkdf2-sha512$1000"]
+  end
+end
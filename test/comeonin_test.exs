@@ -15,6 +15,32 @@ defmodule ComeoninTest do
     assert TestHash.verify_pass("password", hash)
   end
 
+  test "add_hash_stream hashes passwords in order" do
+    passwords = Enum.map(1..50, &"password#{&1}")
+    results = passwords |> TestHash.add_hash_stream(max_concurrency: 4) |> Enum.to_list()
+    assert results == Enum.map(passwords, &%{password_hash: &1})
+  end
+
+  test "add_hash_stream replaces the password in records" do
+    records = Stream.map(1..5, &%{id: &1, pass: "password#{&1}"})
+
+    assert [[first, _], [_, _], [last]] =
+             records
+             |> TestHash.add_hash_stream(password_key: :pass, hash_key: :hash, chunk_size: 2)
+             |> Enum.to_list()
+
+    assert first == %{id: 1, hash: "password1"}
+    assert last == %{id: 5, hash: "password5"}
+  end
+
+  test "add_hash_stream raises for records without a password" do
+    records = [%{id: 1, password: "password1"}, %{id: 2}]
+
+    assert_raise ArgumentError, ~r/:password key/, fn ->
+      records |> TestHash.add_hash_stream() |> Enum.to_list()
+    end
+  end
+
   test "check_pass with default arguments" do
     user = %{password_hash: TestHash.hash_pwd_salt("password")}
     assert {:ok, user_1} = TestHash.check_pass(user, "password")
@@ -38,6 +64,39 @@ defmodule ComeoninTest do
     assert message =~ "no password hash found in the user struct"
   end
 
+  test "check_pass with string keys and keyword rows" do
+    hash = TestHash.hash_pwd_salt("password")
+    assert {:ok, _} = TestHash.check_pass(%{"password_hash" => hash}, "password")
+    assert {:ok, _} = TestHash.check_pass(%{"encrypted_password" => hash}, "password")
+    assert {:ok, _} = TestHash.check_pass(%{"pw" => hash}, "password", hash_key: "pw")
+    assert {:ok, _} = TestHash.check_pass([id: 1, password_hash: hash], "password")
+    assert {:ok, _} = TestHash.check_pass([{"encrypted_password", hash}], "password")
+    assert {:ok, _} = TestHash.check_pass([id: 1, pw: hash], "password", hash_key: :pw)
+    assert {:error, message} = TestHash.check_pass([id: 1], "password")
+    assert message =~ "no password hash found"
+  end
+
+  test "check_pass with list and tuple rows" do
+    hash = TestHash.hash_pwd_salt("password")
+    assert {:ok, _} = TestHash.check_pass([1, "fred", hash], "password", hash_key: 2)
+    assert {:ok, _} = TestHash.check_pass({1, "fred", hash}, "password", hash_key: 2)
+    assert {:error, "invalid password"} = TestHash.check_pass({1, hash}, "wrong", hash_key: 1)
+    assert {:error, message} = TestHash.check_pass({1, "fred"}, "password", hash_key: 5)
+    assert message =~ "no password hash found"
+    assert {:error, _} = TestHash.check_pass([1, "fred", nil], "password", hash_key: 2)
+    assert {:error, message} = TestHash.check_pass({1, false}, "password", hash_key: 1)
+    assert message =~ "no password hash found"
+    assert {:error, message} = TestHash.check_pass(%{password_hash: false}, "password")
+    assert message =~ "no password hash found"
+  end
+
+  test "check_pass with a hash extractor" do
+    row = "1,fred," <> TestHash.hash_pwd_salt("password")
+    extract = fn row -> row |> :binary.split(",", [:global]) |> List.last() end
+    assert {:ok, ^row} = TestHash.check_pass(row, "password", hash_key: extract)
+    assert {:error, _} = TestHash.check_pass(row, "password", hash_key: fn _ -> nil end)
+  end
+
   test "can override add_hash" do
     assert %{password_hash: hash, password: message} = OverrideHash.add_hash("password")
     assert OverrideHash.verify_pass("password", hash)
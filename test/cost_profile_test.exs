@@ -0,0 +1,42 @@
+defmodule Comeonin.CostProfileTest do
+  use ExUnit.Case
+
+  alias Comeonin.{CostHash, CostProfile}
+
+  setup do
+    on_exit(fn ->
+      Application.delete_env(:comeonin, :cost_profile)
+      CostProfile.load()
+    end)
+  end
+
+  test "hash_pwd_salt uses the normal options without a profile" do
+    assert CostHash.hash_pwd_salt("password") == "password:1000"
+    assert CostHash.hash_pwd_salt("password", rounds: 5000) == "password:5000"
+  end
+
+  test "the test profile overrides the options of every helper" do
+    Application.put_env(:comeonin, :cost_profile, :test)
+    assert CostHash.hash_pwd_salt("password") == "password:1000"
+    CostProfile.load()
+    assert CostProfile.profile() == :test
+    assert CostHash.hash_pwd_salt("password") == "password:1"
+    assert CostHash.hash_pwd_salt("password", rounds: 5000) == "password:1"
+    assert %{password_hash: "password:1"} = CostHash.add_hash("password", rounds: 5000)
+  end
+
+  test "built-in options are used when cost_opts is not defined" do
+    assert CostProfile.profile_opts(Bcrypt, :test) == [log_rounds: 4]
+    assert CostProfile.profile_opts(Comeonin.TestHash, :test) == []
+    assert CostProfile.profile_opts(CostHash, :test) == [rounds: 1]
+  end
+
+  test "check! only raises for the test profile in production" do
+    assert CostProfile.check!(nil, true) == :ok
+    assert CostProfile.check!(:test, false) == :ok
+    assert CostProfile.check!(:test) == :ok
+    assert_raise ArgumentError, ~r/production environment/, fn ->
+      CostProfile.check!(:test, true)
+    end
+  end
+end
@@ -0,0 +1,51 @@
+defmodule Comeonin.HashInfoTest do
+  use ExUnit.Case, async: true
+
+  alias Comeonin.HashInfo
+
+  doctest HashInfo
+
+  test "parses argon2 hashes" do
+    hash = "$argon2id$v=19$m=65536,t=3,p=4$c2FsdHNhbHQ$aGFzaGhhc2hoYXNo"
+    assert {:ok, info} = HashInfo.parse(hash)
+    assert info.algorithm == "argon2id"
+    assert info.params == %{"m" => 65536, "t" => 3, "p" => 4}
+    assert info.prefix == "$argon2id$v=19$m=65536,t=3,p=4"
+  end
+
+  test "parses bcrypt hashes" do
+    hash = "$2b$12$" <> String.duplicate("a", 53)
+    assert {:ok, info} = HashInfo.parse(hash)
+    assert info.algorithm == "2b"
+    assert info.params == %{"cost" => 12}
+    assert info.prefix == "$2b$12"
+  end
+
+  test "parses pbkdf2 hashes" do
+    assert HashInfo.prefix("$pbkdf2-sha512$160000$c2FsdA$aGFzaA") == "$pbkdf2-sha512$160000"
+    assert HashInfo.prefix("pbkdf2_sha256$36000$salt$hash") == "pbkdf2_sha256$36000"
+  end
+
+  test "estimates the memory used to verify a hash" do
+    assert HashInfo.memory("$argon2id$v=19$m=65536,t=3,p=4$c2FsdA$aGFzaA") == 64 * 1024 * 1024
+    assert HashInfo.memory("$2b$12$" <> String.duplicate("a", 53)) == 4168
+    assert HashInfo.memory("$pbkdf2-sha512$160000$c2FsdA$aGFzaA") < 1024
+    assert HashInfo.memory("password") == nil
+  end
+
+  test "changes the parameters of a prefix" do
+    prefix = "$argon2id$v=19$m=65536,t=3,p=4"
+    assert HashInfo.put_params(prefix, %{"t" => 4}) == "$argon2id$v=19$m=65536,t=4,p=4"
+    assert HashInfo.put_params("$2b$12", %{"cost" => 9}) == "$2b$09"
+    pbkdf2 = "$pbkdf2-sha512$1000"
+    assert HashInfo.put_params(pbkdf2, %{"rounds" => 2000}) == "$pbkdf2-sha512$2000"
+    assert HashInfo.put_params("pbkdf2_sha256$1000", %{"rounds" => 5}) == "pbkdf2_sha256$5"
+  end
+
+  test "returns an error for unknown formats" do
+    assert HashInfo.parse("password") == :error
+    assert HashInfo.parse("$argon2id$v=19$m=lots$salt$hash") == :error
+    assert HashInfo.parse("$2b$1x$" <> String.duplicate("a", 53)) == :error
+    assert HashInfo.prefix(nil) == nil
+  end
+end
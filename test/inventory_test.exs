@@ -0,0 +1,41 @@
+defmodule Comeonin.InventoryTest do
+  use ExUnit.Case, async: true
+
+  alias Comeonin.Inventory
+
+  @argon2 "$argon2id$v=19$m=65536,t=3,p=4$c2FsdHNhbHQ$aGFzaGhhc2hoYXNo"
+  @bcrypt "$2b$12$" <> String.duplicate("a", 53)
+
+  test "counts hashes by parameters" do
+    lines = List.duplicate(@argon2 <> "\n", 25) ++ List.duplicate(@bcrypt, 5) ++ ["oops", "  "]
+    inventory = Inventory.scan(lines, chunk_size: 7)
+    assert inventory["$argon2id$v=19$m=65536,t=3,p=4"].count == 25
+    assert inventory["$2b$12"] == %{algorithm: "2b", params: %{"cost" => 12}, count: 5}
+    assert inventory[:unknown] == 1
+  end
+
+  test "reads the hash from a column" do
+    lines = ["1,fred,\"#{@bcrypt}\"", "2,barney,#{@argon2}"]
+    inventory = Inventory.scan(lines, column: 2)
+    assert inventory["$2b$12"].count == 1
+    assert inventory["$argon2id$v=19$m=65536,t=3,p=4"].count == 1
+  end
+
+  test "projects the CPU time per 1000 logins" do
+    inventory = Inventory.scan(List.duplicate(@bcrypt, 3) ++ [@argon2])
+    costs = %{"$2b$12" => %{verify_us: 200_000, memory: 4096}}
+    projection = Inventory.project(inventory, costs)
+    assert projection.cpu_seconds_per_1k == 200.0
+    assert projection.covered == 0.75
+    assert projection.missing == ["$argon2id$v=19$m=65536,t=3,p=4"]
+  end
+
+  test "writes and reads inventory files" do
+    path =
+      Path.join(System.tmp_dir!(), "comeonin_inventory_#{System.unique_integer([:positive])}")
+    inventory = Inventory.scan([@bcrypt, @argon2, "oops"])
+    Inventory.write(path, inventory)
+    assert Inventory.read(path) == inventory
+    File.rm!(path)
+  end
+end
@@ -0,0 +1,53 @@
+defmodule Comeonin.LimitsTest do
+  use ExUnit.Case, async: true
+
+  alias Comeonin.Limits
+
+  setup do
+    root = Path.join(System.tmp_dir!(), "comeonin_cgroup_#{System.unique_integer([:positive])}")
+    File.mkdir_p!(root)
+    on_exit(fn -> File.rm_rf!(root) end)
+    {:ok, root: root}
+  end
+
+  test "reads cgroup v2 limits", %{root: root} do
+    File.write!(Path.join(root, "cgroup.controllers"), "cpu memory\n")
+    File.write!(Path.join(root, "cpu.max"), "150000 100000\n")
+    File.write!(Path.join(root, "memory.max"), "536870912\n")
+    assert Limits.read(root) == %{source: :cgroup_v2, cpu_quota: 1.5, memory_limit: 536_870_912}
+
+    File.write!(Path.join(root, "cpu.max"), "max 100000\n")
+    File.write!(Path.join(root, "memory.max"), "max\n")
+    assert Limits.read(root) == %{source: :cgroup_v2, cpu_quota: nil, memory_limit: nil}
+  end
+
+  test "reads cgroup v1 limits", %{root: root} do
+    File.mkdir_p!(Path.join(root, "cpu"))
+    File.mkdir_p!(Path.join(root, "memory"))
+    File.write!(Path.join(root, "cpu/cpu.cfs_quota_us"), "200000\n")
+    File.write!(Path.join(root, "cpu/cpu.cfs_period_us"), "100000\n")
+    File.write!(Path.join(root, "memory/memory.limit_in_bytes"), "9223372036854771712\n")
+    assert Limits.read(root) == %{source: :cgroup_v1, cpu_quota: 2.0, memory_limit: nil}
+
+    File.write!(Path.join(root, "cpu/cpu.cfs_quota_us"), "-1\n")
+    assert Limits.read(root).cpu_quota == nil
+  end
+
+  test "returns no limits without cgroups", %{root: root} do
+    assert Limits.read(root) == %{source: :none, cpu_quota: nil, memory_limit: nil}
+  end
+
+  test "derives the concurrency from the limits" do
+    limits = %{source: :cgroup_v2, cpu_quota: 0.5, memory_limit: 1024 * 1024 * 1024}
+    derived = Limits.derive(limits, per_hash_memory: 64 * 1024 * 1024)
+    assert derived.cores == 1
+    assert derived.concurrency == 1
+    assert derived.memory_budget == 512 * 1024 * 1024
+
+    limits = %{limits | cpu_quota: 64.0}
+    derived = Limits.derive(limits, per_hash_memory: 256 * 1024 * 1024, memory_fraction: 0.5)
+    assert derived.cores == System.schedulers_online()
+    assert derived.concurrency == min(2, derived.dirty_cpu_schedulers)
+    assert Limits.derive(limits, size: 7).concurrency == 7
+  end
+end
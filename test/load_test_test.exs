@@ -0,0 +1,34 @@
+defmodule Comeonin.LoadTestTest do
+  use ExUnit.Case, async: true
+
+  alias Comeonin.LoadTest
+
+  test "generates arrivals in order and within the duration" do
+    arrivals = LoadTest.arrivals(rate: 1000, duration: 0.5, mix: [valid: 1, nil_user: 1])
+    offsets = Enum.map(arrivals, &elem(&1, 0))
+    assert offsets == Enum.sort(offsets)
+    assert Enum.all?(offsets, &(&1 < 500_000))
+    assert arrivals |> Enum.map(&elem(&1, 1)) |> Enum.uniq() |> Enum.sort() == [:nil_user, :valid]
+  end
+
+  test "bursty arrivals come in batches" do
+    arrivals = LoadTest.arrivals(rate: 1000, duration: 0.5, arrival: :bursty, burst_size: 20)
+    offsets = Enum.map(arrivals, &elem(&1, 0))
+    assert length(Enum.uniq(offsets)) < length(offsets)
+  end
+
+  test "runs the requests and reports latencies and outcomes" do
+    arrivals = for offset <- 0..9, kind <- [:valid, :missing_hash], do: {offset * 1000, kind}
+    report = LoadTest.run(Comeonin.TestHash, arrivals: arrivals, concurrency: 2)
+    assert report.requests == 20
+    assert report.outcomes == %{{:valid, :ok} => 10, {:missing_hash, :error} => 10}
+    assert report.latency.max >= report.service_latency[50]
+    assert Map.has_key?(report.scheduler_utilization, :normal)
+  end
+
+  test "calculates nearest-rank percentiles" do
+    values = Enum.to_list(1..100)
+    assert LoadTest.percentiles(values, [50, 99]) == %{50 => 50, 99 => 99, :max => 100}
+    assert LoadTest.percentiles([], [50]) == %{50 => 0, :max => 0}
+  end
+end
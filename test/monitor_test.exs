@@ -0,0 +1,51 @@
+defmodule Comeonin.MonitorTest do
+  use ExUnit.Case
+
+  alias Comeonin.Monitor
+
+  @report %{saturated: 0.5, hashing_share: 0.8}
+
+  test "recommends no action when the dirty schedulers are not saturated" do
+    assert %{action: :none} = Monitor.recommend(%{@report | saturated: 0.01}, 4, 4)
+  end
+
+  test "recommends more dirty schedulers when there are spare cores" do
+    assert %{action: :raise_dirty_cpu, value: 8, message: message} =
+             Monitor.recommend(@report, 4, 8)
+
+    assert message =~ "+SDcpu"
+  end
+
+  test "recommends a hashing cap when hashing saturates the dirty schedulers" do
+    assert %{action: :cap_hashing, value: 3} = Monitor.recommend(@report, 4, 4)
+    assert %{action: :cap_hashing, value: 1} = Monitor.recommend(@report, 1, 1)
+    assert %{action: :check_other_nifs} = Monitor.recommend(%{@report | hashing_share: 0.1}, 4, 4)
+  end
+
+  test "samples the dirty scheduler utilization" do
+    pid = start_supervised!({Monitor, interval: 60_000, threshold: 0.0})
+
+    for _ <- 1..3 do
+      Process.sleep(5)
+      send(pid, :sample)
+    end
+
+    report = Monitor.report()
+    assert report.samples == 3
+    assert report.saturated == 1.0
+    assert report.utilization >= 0.0 and report.utilization <= 1.0
+    assert [%{duration_ms: duration}] = report.periods
+    assert duration >= 60_000
+    assert report.recommendation.action != :none
+  end
+
+  test "restores the scheduler_wall_time flag when it stops" do
+    enabled? = fn -> :erlang.statistics(:scheduler_wall_time) != :undefined end
+    enabled = enabled?.()
+    start_supervised!({Monitor, interval: 60_000})
+    assert enabled?.()
+
+    :ok = stop_supervised(Monitor)
+    assert enabled?.() == enabled
+  end
+end
@@ -0,0 +1,78 @@
+if Code.ensure_loaded?(Comeonin.Pbkdf2Hmac) do
+  defmodule Comeonin.Pbkdf2HmacTest do
+    use ExUnit.Case, async: true
+
+    import Comeonin.BehaviourTestHelper
+
+    alias Comeonin.Pbkdf2Hmac
+
+    doctest Pbkdf2Hmac
+
+    @sha512 "$pbkdf2-sha512$1000$MDEyMzQ1Njc4OWFiY2RlZg$" <>
+              "38DzhdBT7fPaUGBlsh42VTuuKSFAIYGZJ7l6feCDLIl" <>
+              ".K3hdPFgxxu7xuUi4gIuH6cEIoODn18xH9Ig2ryNgUw"
+    @sha256 "$pbkdf2-sha256$1000$MDEyMzQ1Njc4OWFiY2RlZg$" <>
+              "hRRjgXWkW8ResfIvBP99J/T4vkgEmMRV/0tJTOjR59I"
+
+    test "verifies hashes in the pbkdf2_elixir and passlib format" do
+      assert Pbkdf2Hmac.verify_pass("password", @sha512)
+      assert Pbkdf2Hmac.verify_pass("password", @sha256)
+      refute Pbkdf2Hmac.verify_pass("passwore", @sha512)
+      refute Pbkdf2Hmac.verify_pass("passwore", @sha256)
+    end
+
+    test "hashes in the modular crypt format" do
+      hash = Pbkdf2Hmac.hash_pwd_salt("password", rounds: 1000)
+      assert ["", "pbkdf2-sha512", "1000", salt, checksum] = String.split(hash, "$")
+      assert byte_size(salt) == 22
+      assert byte_size(checksum) == 86
+      refute hash =~ "+"
+      refute hash =~ "="
+
+      assert {:ok, %{algorithm: "pbkdf2-sha512"}} = Comeonin.HashInfo.parse(hash)
+    end
+
+    test "digest, salt and key length options" do
+      opts = [rounds: 10, digest: :sha256, salt_len: 32, length: 20]
+      hash = Pbkdf2Hmac.hash_pwd_salt("password", opts)
+      assert ["", "pbkdf2-sha256", "10", salt, checksum] = String.split(hash, "$")
+      assert byte_size(salt) == 43
+      assert byte_size(checksum) == 27
+      assert Pbkdf2Hmac.verify_pass("password", hash)
+
+      assert_raise ArgumentError, fn -> Pbkdf2Hmac.hash_pwd_salt("password", digest: :md5) end
+    end
+
+    test "invalid hashes do not verify" do
+      for hash <- [
+            "",
+            "$2b$12$abcdefghijklmnopqrstuu",
+            "$pbkdf2-md5$1000$MDEyMzQ1Njc4OWFiY2RlZg$hRRjgXWkW8ResfIvBP99J/T4vkgEmMRV/0tJTOjR59I",
+            "$pbkdf2-sha256$0$MDEyMzQ1Njc4OWFiY2RlZg$hRRjgXWkW8ResfIvBP99J/T4vkgEmMRV/0tJTOjR59I",
+            "$pbkdf2-sha256$1000$MDEyMzQ1Njc4OWFiY2RlZg$",
+            "$pbkdf2-sha256$1000$!!$hRRjgXWkW8ResfIvBP99J/T4vkgEmMRV/0tJTOjR59I",
+            nil,
+            false
+          ] do
+        refute Pbkdf2Hmac.verify_pass("password", hash)
+      end
+
+      refute Pbkdf2Hmac.verify_pass(nil, @sha512)
+    end
+
+    test "implementation of Comeonin.PasswordHash behaviour" do
+      opts = [rounds: 1000]
+
+      for password <- [Enum.random(ascii_passwords()), Enum.random(non_ascii_passwords())] do
+        assert correct_password_true(Pbkdf2Hmac, password, opts)
+        assert wrong_password_false(Pbkdf2Hmac, password, opts)
+        assert add_hash_creates_map(Pbkdf2Hmac, password, opts)
+        assert check_pass_returns_user(Pbkdf2Hmac, password, opts)
+        assert check_pass_returns_error(Pbkdf2Hmac, password, opts)
+      end
+
+      assert check_pass_nil_user(Pbkdf2Hmac)
+      assert Pbkdf2Hmac.cost_opts(:test) == [rounds: 1]
+    end
+  end
+end
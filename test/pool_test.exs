@@ -0,0 +1,184 @@
+defmodule Comeonin.PoolTest do
+  use ExUnit.Case
+
+  alias Comeonin.{NativeHash, Pool, TestHash}
+
+  test "runs functions in the calling process when the pool is not running" do
+    assert Pool.run(fn -> self() end) == self()
+  end
+
+  test "runs functions in the pool workers" do
+    start_supervised!({Pool, size: 2})
+    assert Pool.run(fn -> self() end) != self()
+    assert %{size: 2, limits: %{concurrency: 2}} = Pool.info()
+
+    results = Task.async_stream(1..10, fn n -> Pool.run(fn -> n * 2 end) end) |> Enum.to_list()
+    assert Enum.map(results, fn {:ok, n} -> n end) == Enum.map(1..10, &(&1 * 2))
+  end
+
+  test "re-raises errors in the caller" do
+    start_supervised!({Pool, size: 1})
+    assert_raise RuntimeError, "oops", fn -> Pool.run(fn -> raise "oops" end) end
+    assert Pool.run(fn -> :still_working end) == :still_working
+  end
+
+  test "the helper functions run through the pool" do
+    start_supervised!({Pool, size: 1})
+    %{password_hash: hash} = TestHash.add_hash("password")
+    assert {:ok, _} = TestHash.check_pass(%{password_hash: hash}, "password")
+  end
+
+  test "runs the calls with the highest priority first" do
+    start_supervised!({Pool, size: 1})
+    test = self()
+
+    blocker =
+      Task.async(fn ->
+        Pool.run(fn ->
+          send(test, {:worker, self()})
+          receive(do: (:go -> :ok))
+        end)
+      end)
+
+    assert_receive {:worker, worker}
+
+    tasks =
+      for priority <- [:low, :normal, :high] do
+        run = fn -> send(test, {:ran, priority}) end
+        task = Task.async(fn -> Pool.run(run, priority: priority) end)
+        wait_until(fn -> Pool.info().queued_by_priority[priority] == 1 end)
+        task
+      end
+
+    send(worker, :go)
+    Enum.each([blocker | tasks], &Task.await/1)
+    order = for _ <- 1..3, do: receive(do: ({:ran, priority} -> priority))
+    assert order == [:high, :normal, :low]
+  end
+
+  test "only the hash runs in the pool workers" do
+    start_supervised!({Pool, size: 1})
+    caller = self()
+
+    hash_key = fn user ->
+      send(caller, {:get_hash, self()})
+      user.password_hash
+    end
+
+    %{password_hash: hash} = TestHash.add_hash("password")
+    assert {:ok, _} = TestHash.check_pass(%{password_hash: hash}, "password", hash_key: hash_key)
+    assert_received {:get_hash, ^caller}
+  end
+
+  test "drops the queued calls of callers that exit" do
+    start_supervised!({Pool, size: 1})
+    {worker, blocker} = block_pool()
+    test = self()
+
+    {pid, ref} = spawn_monitor(fn -> Pool.run(fn -> send(test, :ran) end) end)
+    wait_until(fn -> Pool.info().queued == 1 end)
+    Process.exit(pid, :kill)
+    assert_receive {:DOWN, ^ref, :process, ^pid, :killed}
+    wait_until(fn -> Pool.info().queued == 0 end)
+
+    send(worker, :go)
+    Task.await(blocker)
+    assert Pool.run(fn -> :ok end) == :ok
+    refute_received :ran
+  end
+
+  test "returns an error when the queue is full" do
+    start_supervised!({Pool, size: 1, max_queue: 1})
+    {worker, blocker} = block_pool()
+
+    waiting = Task.async(fn -> Pool.run(fn -> :ran end) end)
+    wait_until(fn -> Pool.info().queued == 1 end)
+    assert Pool.run(fn -> :ran end) == {:error, :overloaded}
+
+    send(worker, :go)
+    assert Task.await(waiting) == :ran
+    Task.await(blocker)
+  end
+
+  test "returns an error when a call waits longer than its timeout" do
+    start_supervised!({Pool, size: 1})
+    {worker, blocker} = block_pool()
+
+    assert Pool.run(fn -> :ran end, timeout: 20) == {:error, :overloaded}
+    assert Pool.info().queued == 0
+    assert TestHash.check_pass(%{password_hash: "x"}, "x", timeout: 20) ==
+             {:error, "hashing is overloaded"}
+
+    send(worker, :go)
+    Task.await(blocker)
+    assert Pool.run(fn -> :ran end, timeout: 20) == :ran
+  end
+
+  test "rejects unknown priorities" do
+    start_supervised!({Pool, size: 1})
+    assert_raise ArgumentError, fn -> Pool.run(fn -> :ok end, priority: :urgent) end
+  end
+
+  test "trims idle workers and grows back when calls arrive" do
+    opts = [size: 3, idle_timeout: 50, min_workers: 1, hibernate_after: 10]
+    start_supervised!({Pool, opts})
+    NativeHash.add_hash("password")
+    assert %{workers: 3} = Pool.info()
+
+    wait_until(fn -> Pool.info().workers == 1 end)
+    wait_until(fn -> :persistent_term.get({NativeHash, :trims}, 0) > 0 end)
+
+    test = self()
+
+    tasks =
+      for _ <- 1..3 do
+        Task.async(fn -> Pool.run(fn -> receive(do: (:go -> send(test, :ran))) end) end)
+      end
+
+    wait_until(fn -> Pool.info().busy == 3 end)
+    assert %{workers: 3, size: 3} = Pool.info()
+
+    Pool |> :sys.get_state() |> Map.get(:busy) |> Map.keys() |> Enum.each(&send(&1, :go))
+    Enum.each(tasks, &Task.await/1)
+  end
+
+  test "trims the implementations of the :modules option" do
+    trims = :persistent_term.get({NativeHash, :trims}, 0)
+    start_supervised!({Pool, size: 1, idle_timeout: 20, modules: [NativeHash]})
+    wait_until(fn -> :persistent_term.get({NativeHash, :trims}, 0) > trims end)
+  end
+
+  test "workers hibernate again after each idle period" do
+    start_supervised!({Pool, size: 1, hibernate_after: 10})
+    worker = Pool.run(fn -> self() end)
+    hibernating = {:current_function, {:erlang, :hibernate, 3}}
+    hibernated? = fn -> Process.info(worker, :current_function) == hibernating end
+
+    wait_until(hibernated?)
+    assert Pool.run(fn -> self() end) == worker
+    wait_until(hibernated?)
+  end
+
+  # Keeps the only worker of the pool busy until it is sent :go.
+  defp block_pool do
+    test = self()
+
+    blocker =
+      Task.async(fn ->
+        Pool.run(fn ->
+          send(test, {:worker, self()})
+          receive(do: (:go -> :ok))
+        end)
+      end)
+
+    assert_receive {:worker, worker}
+    {worker, blocker}
+  end
+
+  defp wait_until(fun) do
+    unless fun.() do
+      Process.sleep(5)
+      wait_until(fun)
+    end
+  end
+end
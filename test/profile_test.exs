@@ -0,0 +1,60 @@
+defmodule Comeonin.ProfileTest do
+  use ExUnit.Case
+
+  alias Comeonin.Profile
+
+  test "assigns functions to categories" do
+    assert Profile.category({Comeonin.TestHash, :check_pass, 3}, Comeonin.TestHash) == :wrapper
+    assert Profile.category({Keyword, :get, 3}, Comeonin.TestHash) == :wrapper
+    assert Profile.category({:crypto, :strong_rand_bytes, 1}, Argon2) == :salt
+    assert Profile.category({Argon2, :gen_salt, 1}, Argon2) == :salt
+    assert Profile.category({Argon2, :hash_pwd_salt, 2}, Argon2) == :kdf
+    assert Profile.category({Argon2.Base, :hash_nif, 10}, Argon2) == :kdf
+    assert Profile.category({Comeonin.Stats, :start, 2}, Comeonin.Pbkdf2Hmac) == :wrapper
+    assert Profile.category({Comeonin.Pool, :run, 2}, Comeonin.Pbkdf2Hmac) == :wrapper
+    assert Profile.category({:ets, :lookup, 2}, Comeonin.Pbkdf2Hmac) == :wrapper
+    assert Profile.category({:gen, :do_call, 4}, Comeonin.Pbkdf2Hmac) == :wrapper
+
+    assert Profile.category({Comeonin.Pbkdf2Hmac, :hash_pwd_salt, 2}, Comeonin.Pbkdf2Hmac) ==
+             :kdf
+  end
+
+  test "folds call times and sums categories" do
+    times = [{{Keyword, :get, 3}, 10}, {{Argon2.Base, :hash_nif, 10}, 900}]
+
+    assert Profile.fold(times, Argon2) == [
+             "erlang;kdf;Argon2.Base.hash_nif/10 900",
+             "erlang;wrapper;Keyword.get/3 10"
+           ]
+
+    assert Profile.totals(times, Argon2) == %{wrapper: 10, salt: 0, kdf: 900}
+  end
+
+  test "folds perf script output" do
+    script = """
+    beam.smp 1234 100.0: 1 cycles:
+    \t7f0001 argon2_fill_segment (/lib/argon2_nif.so)
+    \t7f0002 argon2_hash (/lib/argon2_nif.so)
+
+    beam.smp 1234 100.1: 1 cycles:
+    \t7f0001 argon2_fill_segment (/lib/argon2_nif.so)
+    \t7f0002 argon2_hash (/lib/argon2_nif.so)
+    """
+
+    assert Profile.fold_perf_script(script) == ["native;argon2_hash;argon2_fill_segment 2"]
+  end
+
+  test "profiles the workload" do
+    workload = Profile.workload(Comeonin.TestHash, [], 2)
+    times = Profile.call_times(workload)
+    assert {_, _} = List.keyfind(times, {Comeonin.TestHash, :verify_pass, 2}, 0)
+  end
+
+  test "profiles the hashes that run in the pool" do
+    start_supervised!({Comeonin.Pool, size: 2})
+    workload = Profile.workload(Comeonin.TestHash, [], 2)
+    times = Profile.call_times(workload)
+    assert {_, _} = List.keyfind(times, {Comeonin.TestHash, :verify_pass, 2}, 0)
+    assert {_, _} = List.keyfind(times, {Comeonin.TestHash, :hash_pwd_salt, 2}, 0)
+  end
+end
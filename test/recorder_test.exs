@@ -0,0 +1,55 @@
+defmodule Comeonin.RecorderTest do
+  use ExUnit.Case
+
+  alias Comeonin.{Recorder, TestHash}
+
+  setup do
+    path = Path.join(System.tmp_dir!(), "comeonin_#{System.unique_integer([:positive])}.trace")
+    on_exit(fn -> File.rm(path) end)
+    {:ok, path: path}
+  end
+
+  test "does nothing when the recorder is not running" do
+    assert Recorder.start_time() == nil
+    assert Recorder.record(:check_pass, :ok, "hash", nil) == :ok
+  end
+
+  test "records calls to add_hash and check_pass", %{path: path} do
+    pid = start_supervised!({Recorder, path: path})
+    %{password_hash: hash} = TestHash.add_hash("password")
+    TestHash.check_pass(%{password_hash: hash}, "password")
+    TestHash.check_pass(%{password_hash: hash}, "wrong")
+    TestHash.check_pass(nil, "password")
+    TestHash.check_pass(%{}, "password")
+    :sys.get_state(pid)
+    :ok = stop_supervised(Recorder)
+
+    records = Recorder.read(path)
+    assert Enum.map(records, &{&1.operation, &1.outcome}) == [
+             add_hash: :ok,
+             check_pass: :ok,
+             check_pass: :invalid_password,
+             check_pass: :no_user,
+             check_pass: :no_hash
+           ]
+
+    assert Enum.all?(records, &(&1.prefix == ""))
+    assert Recorder.start_time() == nil
+  end
+
+  test "records the hash parameters but not the hash", %{path: path} do
+    hash = "$2b$12$" <> String.duplicate("a", 53)
+    File.write!(path, ["CMNTRC1\n", Recorder.encode(:check_pass, :ok, hash, 250_000)])
+    assert [%{prefix: "$2b$12", duration: 250_000}] = Recorder.read(path)
+  end
+
+  test "converts records to arrivals" do
+    records = [
+      %{timestamp: 1_000, operation: :check_pass, outcome: :ok},
+      %{timestamp: 3_000, operation: :check_pass, outcome: :invalid_input},
+      %{timestamp: 5_000, operation: :add_hash, outcome: :ok}
+    ]
+
+    assert Recorder.arrivals(records, 2.0) == [{0, :valid}, {2000, :add_hash}]
+  end
+end
@@ -0,0 +1,31 @@
+defmodule Comeonin.SecureCompareTest do
+  use ExUnit.Case, async: true
+
+  alias Comeonin.SecureCompare
+
+  doctest SecureCompare
+
+  test "compares binaries of every length around the word size" do
+    for size <- 0..40 do
+      left = :crypto.strong_rand_bytes(size)
+      assert SecureCompare.equal?(left, :binary.copy(left))
+
+      for position <- 0..size, position < size do
+        <<before::binary-size(position), byte, rest::binary>> = left
+        refute SecureCompare.equal?(left, <<before::binary, 255 - byte, rest::binary>>)
+      end
+    end
+  end
+
+  test "binaries of different lengths are not equal" do
+    refute SecureCompare.equal?("hash", "hash ")
+    refute SecureCompare.equal?("", "a")
+  end
+
+  test "the benchmark times every case" do
+    assert [result] = Comeonin.Benchmark.secure_compare(sizes: [32], iterations: 1000)
+    assert result.size == 32
+    assert result[{:secure, :last_differs}] > 0
+    assert result[{:bytewise, :equal}] > 0
+  end
+end
@@ -0,0 +1,71 @@
+defmodule Comeonin.ServerTest do
+  use ExUnit.Case
+
+  import Bitwise
+
+  alias Comeonin.{Server, Stats, TestHash}
+
+  setup do
+    path = Path.join(System.tmp_dir!(), "comeonin_#{System.unique_integer([:positive])}.sock")
+    start_supervised!({Server, module: TestHash, path: path})
+    {:ok, socket} = :gen_tcp.connect({:local, path}, 0, [:binary, packet: 4, active: false])
+    on_exit(fn -> File.rm(path) end)
+    {:ok, socket: socket, path: path}
+  end
+
+  test "hashes and verifies passwords", %{socket: socket} do
+    assert request(socket, <<1, 1, "password">>) == <<0, "password">>
+    assert request(socket, <<2, 0, 8::32, "password", "password">>) == <<0, 1>>
+    assert request(socket, <<2, 2, 5::32, "wrong", "password">>) == <<0, 0>>
+  end
+
+  test "rejects invalid requests", %{socket: socket} do
+    assert request(socket, <<3, 1, "password">>) == <<1, "invalid request">>
+    assert request(socket, <<1, 7, "password">>) == <<1, "invalid request">>
+    assert request(socket, <<2, 1, 100::32, "short">>) == <<1, "invalid request">>
+  end
+
+  test "requests are counted in the stats", %{socket: socket} do
+    before = Stats.histogram(TestHash, :check_pass) |> Enum.sum()
+    request(socket, <<2, 1, 8::32, "password", "password">>)
+    assert Enum.sum(Stats.histogram(TestHash, :check_pass)) == before + 1
+  end
+
+  test "the socket has the configured mode", %{path: path} do
+    assert (File.stat!(path).mode &&& 0o777) == 0o660
+    prefix = ".comeonin_#{:os.getpid()}_"
+    refute path |> Path.dirname() |> File.ls!() |> Enum.any?(&String.starts_with?(&1, prefix))
+  end
+
+  test "closes connections that send oversized requests", %{socket: socket} do
+    :ok = :gen_tcp.send(socket, <<1, 1, :binary.copy("a", 70_000)::binary>>)
+    assert {:error, :closed} = :gen_tcp.recv(socket, 0, 1000)
+  end
+
+  test "removes the socket when it stops", %{path: path} do
+    assert File.exists?(path)
+    :ok = stop_supervised(Server)
+    refute File.exists?(path)
+  end
+
+  test "replaces a stale socket, but nothing else", %{path: path} do
+    :ok = stop_supervised(Server)
+    {:ok, stale} = :gen_tcp.listen(0, ifaddr: {:local, path})
+    :ok = :gen_tcp.close(stale)
+    assert {:ok, _} = start_supervised({Server, module: TestHash, path: path})
+    :ok = stop_supervised(Server)
+
+    File.write!(path, "not a socket")
+
+    assert {:error, {{:listen, ^path, {:not_a_socket, ^path}}, _}} =
+             start_supervised({Server, module: TestHash, path: path})
+
+    assert File.read!(path) == "not a socket"
+  end
+
+  defp request(socket, request) do
+    :ok = :gen_tcp.send(socket, request)
+    {:ok, response} = :gen_tcp.recv(socket, 0, 1000)
+    response
+  end
+end
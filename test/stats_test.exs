@@ -0,0 +1,58 @@
+defmodule Comeonin.StatsTest do
+  use ExUnit.Case, async: true
+
+  import Bitwise
+
+  alias Comeonin.{NativeHash, Stats, TestHash}
+
+  test "buckets cover every value and are ordered" do
+    values = Enum.to_list(0..5000) ++ [1_000_000, 60_000_000, 1 <<< 40]
+    buckets = Enum.map(values, &Stats.bucket/1)
+    assert buckets == Enum.sort(buckets)
+
+    for value <- values, value < 1 <<< 36 do
+      index = Stats.bucket(value)
+      assert value <= Stats.bucket_max(index)
+      assert index == 0 or value > Stats.bucket_max(index - 1)
+    end
+  end
+
+  test "bucket error is at most 12.5%" do
+    for value <- [17, 100, 999, 12_345, 250_000, 3_000_000] do
+      assert Stats.bucket_max(Stats.bucket(value)) <= value * 1.125
+    end
+  end
+
+  test "counts calls to the helper functions" do
+    before = stats(TestHash, :check_pass)
+    %{password_hash: hash} = TestHash.add_hash("password")
+    TestHash.check_pass(%{password_hash: hash}, "password")
+    TestHash.check_pass(%{password_hash: hash}, "wrong")
+    stats = stats(TestHash, :check_pass)
+    assert stats.count >= before.count + 2
+    assert stats.rejected >= before.rejected + 1
+    assert stats.percentiles[:max] >= stats.percentiles[50]
+    assert stats(TestHash, :add_hash).count >= 1
+  end
+
+  test "folds in the native stats of implementations" do
+    NativeHash.add_hash("password")
+    assert %{calls: 10, raw: raw} = native = Enum.find(Stats.native(), &(&1.module == NativeHash))
+    assert native.kdf_us == 500.0
+    assert native.marshal_us == 10.0
+    assert native.alloc_bytes == 4096.0
+    assert native.arena_reuse == 0.9
+    assert native.wrapper_us >= 0.0
+    assert raw.kdf_us == 5000
+    refute Enum.find(Stats.native(), &(&1.module == TestHash))
+  end
+
+  test "stop ignores the nil token returned when the stats are off" do
+    assert Stats.stop(nil, :ok) == :ok
+  end
+
+  defp stats(module, operation) do
+    Enum.find(Stats.snapshot(), &(&1.module == module and &1.operation == operation)) ||
+      %{count: 0, rejected: 0}
+  end
+end
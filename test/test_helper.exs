@@ -53,3 +53,63 @@ defmodule Comeonin.OverrideHash do
     password == hash
   end
 end
+
+defmodule Comeonin.CostHash do
+  use Comeonin
+
+  @impl true
+  def hash_pwd_salt(password, opts \\ []) do
+    "#{password}:#{Keyword.get(opts, :rounds, 1000)}"
+  end
+
+  @impl true
+  def verify_pass(password, hash) do
+    String.starts_with?(hash, password <> ":")
+  end
+
+  @impl true
+  def cost_opts(:test), do: [rounds: 1]
+end
+
+defmodule Comeonin.SlowHash do
+  use Comeonin
+
+  @impl true
+  def hash_pwd_salt(password, _opts \\ []) do
+    Process.sleep(div(byte_size(password), 256))
+    password
+  end
+
+  @impl true
+  def verify_pass(password, hash) do
+    password == hash
+  end
+end
+
+defmodule Comeonin.NativeHash do
+  use Comeonin
+
+  @impl true
+  def hash_pwd_salt(password, _opts \\ []), do: password
+
+  @impl true
+  def verify_pass(password, hash), do: password == hash
+
+  @impl true
+  def native_stats do
+    %{
+      calls: 10,
+      kdf_us: 5000,
+      marshal_us: 100,
+      alloc_bytes: 40_960,
+      arena_reuses: 9,
+      arena_allocs: 1
+    }
+  end
+
+  @impl true
+  def trim_memory do
+    trims = :persistent_term.get({__MODULE__, :trims}, 0)
+    :persistent_term.put({__MODULE__, :trims}, trims + 1)
+  end
+end
@@ -0,0 +1,81 @@
+defmodule Comeonin.TicketTest do
+  use ExUnit.Case, async: true
+
+  alias Comeonin.{TestHash, Ticket}
+
+  @secret String.duplicate("s", 32)
+  @opts [ticket_secret: @secret]
+
+  test "check_pass returns a ticket that verify_ticket accepts" do
+    user = %{id: 42, password_hash: TestHash.hash_pwd_salt("password")}
+    opts = [ticket: true] ++ @opts
+    assert {:ok, ^user, ticket} = TestHash.check_pass(user, "password", opts)
+    assert TestHash.verify_ticket(user, ticket, @opts) == {:ok, user}
+    assert {:error, "invalid password"} = TestHash.check_pass(user, "wrong", opts)
+  end
+
+  test "tickets are bound to the user and the stored hash" do
+    hash = TestHash.hash_pwd_salt("password")
+    ticket = Ticket.issue(1, hash, @opts)
+    assert Ticket.verify(1, hash, ticket, @opts) == :ok
+    assert Ticket.verify(2, hash, ticket, @opts) == {:error, :invalid}
+    new_hash = TestHash.hash_pwd_salt("new password")
+    assert Ticket.verify(1, new_hash, ticket, @opts) == {:error, :invalid}
+    other_secret = [ticket_secret: String.duplicate("x", 32)]
+    assert Ticket.verify(1, hash, ticket, other_secret) == {:error, :invalid}
+    assert Ticket.verify(1, hash, "not a ticket", @opts) == {:error, :invalid}
+  end
+
+  test "missing tickets are invalid" do
+    user = %{id: 1, password_hash: "hash"}
+    assert Ticket.verify(1, "hash", nil, @opts) == {:error, :invalid}
+    assert TestHash.verify_ticket(user, nil, @opts) == {:error, "invalid ticket"}
+    assert TestHash.verify_ticket(user, 123, @opts) == {:error, "invalid ticket"}
+  end
+
+  test "tickets expire" do
+    ticket = Ticket.issue("fred", "hash", [ticket_ttl: -1] ++ @opts)
+    assert Ticket.verify("fred", "hash", ticket, @opts) == {:error, :expired}
+    user = %{name: "fred", password_hash: "hash"}
+    opts = [user_id_key: :name] ++ @opts
+    assert TestHash.verify_ticket(user, ticket, opts) == {:error, "ticket has expired"}
+  end
+
+  test "users without an id do not have valid tickets" do
+    ticket = Ticket.issue(1, "hash", @opts)
+    assert Ticket.user_id({1, "hash"}, user_id_key: 5) == nil
+    assert Ticket.user_id("1,hash", user_id_key: 0) == nil
+    assert TestHash.verify_ticket("1,hash", ticket, @opts) == {:error, "invalid ticket"}
+    opts = [user_id_key: 3] ++ @opts
+    assert TestHash.verify_ticket({1}, ticket, opts) == {:error, "invalid ticket"}
+  end
+
+  test "string-keyed maps and keyword lists use the \"id\" key" do
+    hash = TestHash.hash_pwd_salt("password")
+    opts = [ticket: true] ++ @opts
+
+    for user <- [%{"id" => 7, "password_hash" => hash}, [{"id", 7}, {"password_hash", hash}]] do
+      assert Ticket.user_id(user, []) == 7
+      assert {:ok, ^user, ticket} = TestHash.check_pass(user, "password", opts)
+      assert TestHash.verify_ticket(user, ticket, @opts) == {:ok, user}
+    end
+  end
+
+  test "no ticket is issued for a user without an id" do
+    user = %{name: "fred", password_hash: TestHash.hash_pwd_salt("password")}
+
+    assert TestHash.check_pass(user, "password", [ticket: true] ++ @opts) ==
+             {:error, "no user id found in the user struct"}
+
+    assert Ticket.verify(nil, "hash", Ticket.issue(nil, "hash", @opts), @opts) ==
+             {:error, :invalid}
+  end
+
+  test "a secret is required" do
+    assert_raise ArgumentError, ~r/ticket_secret/, fn -> Ticket.issue(1, "hash") end
+
+    assert_raise ArgumentError, ~r/ticket_secret/, fn ->
+      Ticket.issue(1, "hash", ticket_secret: "short")
+    end
+  end
+end